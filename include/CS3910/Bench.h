@@ -0,0 +1,228 @@
+#ifndef CS3910__BENCH_H_
+#define CS3910__BENCH_H_
+
+#include "Pallets.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <ostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A small harness for microbenchmarks. A benchmark is run once for every set
+// of its parameters, the setup builds the state for the set and returns the
+// body, which is timed in batches of calls long enough for the clock. Every
+// run writes a line of JSON with the parameters and the time of a call in
+// nanoseconds, the least, the median and the mean over the batches.
+
+// The named parameters of a run, in order.
+using BenchParams = std::vector<std::pair<std::string, std::size_t>>;
+
+class BenchSuite final
+{
+public:
+    using Body = std::function<void()>;
+
+    using Setup = std::function<Body(BenchParams const&)>;
+
+    void Add(std::string name, std::vector<BenchParams> runs, Setup setup);
+
+    // Run the benchmarks whose name contains the filter.
+    void Run(std::string const& filter, std::ostream& outs) const;
+
+private:
+    struct Benchmark
+    {
+        std::string name;
+        std::vector<BenchParams> runs;
+        Setup setup;
+    };
+
+    // Configuration
+    constexpr static std::chrono::nanoseconds MinBatchTime{20'000'000};
+    constexpr static std::size_t Batches = 10;
+
+    std::vector<Benchmark> benchmarks_{};
+};
+
+// Every combination of the values of the parameters, the last varies
+// fastest.
+std::vector<BenchParams> ParamGrid(
+    std::vector<std::pair<std::string, std::vector<std::size_t>>> const&
+        axes);
+
+// The value of a parameter of a run, which must have it.
+std::size_t Param(BenchParams const& params, std::string const& name);
+
+// Keep the compiler from optimising away the computation of a value.
+template<typename T>
+void KeepValue(T const& value) noexcept;
+
+// Random data read back from a temporary file in the format of the sample
+// data, the demand is a noisy linear function of the columns.
+PalletData RandomPalletData(
+    std::size_t rows,
+    std::size_t columns,
+    std::uint32_t seed);
+
+// Write random data to a file in the format of the sample data.
+void WriteRandomPalletData(
+    std::string const& fileName,
+    std::size_t rows,
+    std::size_t columns,
+    std::uint32_t seed);
+
+void BenchSuite::Add(
+    std::string name,
+    std::vector<BenchParams> runs,
+    Setup setup)
+{
+    benchmarks_.push_back(Benchmark{
+        std::move(name),
+        std::move(runs),
+        std::move(setup)});
+}
+
+void BenchSuite::Run(std::string const& filter, std::ostream& outs) const
+{
+    using Clock = std::chrono::steady_clock;
+    for(auto const& benchmark: benchmarks_)
+    {
+        if(benchmark.name.find(filter) == std::string::npos)
+            continue;
+
+        for(auto const& params: benchmark.runs)
+        {
+            auto body = benchmark.setup(params);
+            auto const Time = [&](std::size_t calls)
+            {
+                auto const Start = Clock::now();
+                for(std::size_t i{}; i != calls; ++i)
+                    body();
+                return Clock::now() - Start;
+            };
+
+            // Warm up, then double the batch until it takes long enough
+            Time(1);
+            std::size_t calls{1};
+            while(Time(calls) < MinBatchTime)
+                calls *= 2;
+
+            std::vector<double> times(Batches);
+            for(auto& time: times)
+                time = std::chrono::duration<double, std::nano>{
+                    Time(calls)}.count() / calls;
+            std::sort(times.begin(), times.end());
+
+            outs << "{\"benchmark\":\"" << benchmark.name << '"';
+            for(auto const& [name, value]: params)
+                outs << ",\"" << name << "\":" << value;
+            outs << ",\"calls\":" << calls
+                << ",\"batches\":" << Batches
+                << ",\"min_ns\":" << times.front()
+                << ",\"median_ns\":" << times[Batches / 2]
+                << ",\"mean_ns\":" << std::accumulate(
+                    times.cbegin(),
+                    times.cend(),
+                    0.0) / Batches
+                << "}\n" << std::flush;
+        }
+    }
+}
+
+std::vector<BenchParams> ParamGrid(
+    std::vector<std::pair<std::string, std::vector<std::size_t>>> const&
+        axes)
+{
+    std::vector<BenchParams> grid{BenchParams{}};
+    for(auto const& [name, values]: axes)
+    {
+        std::vector<BenchParams> next{};
+        for(auto const& params: grid)
+            for(auto value: values)
+            {
+                next.push_back(params);
+                next.back().emplace_back(name, value);
+            }
+        grid = std::move(next);
+    }
+
+    return grid;
+}
+
+std::size_t Param(BenchParams const& params, std::string const& name)
+{
+    auto const It = std::find_if(
+        params.cbegin(),
+        params.cend(),
+        [&](auto const& param) { return param.first == name; });
+    assert(It != params.cend() && "No such parameter");
+    return It->second;
+}
+
+template<typename T>
+void KeepValue(T const& value) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *reinterpret_cast<char const volatile*>(&value);
+#endif
+}
+
+PalletData RandomPalletData(
+    std::size_t rows,
+    std::size_t columns,
+    std::uint32_t seed)
+{
+    auto const FileName = (std::filesystem::temp_directory_path()
+        / ("cs3910-bench-" + std::to_string(rows) + '-'
+            + std::to_string(columns) + '-' + std::to_string(seed) + ".csv"))
+        .string();
+    WriteRandomPalletData(FileName, rows, columns, seed);
+    PalletData data{FileName.c_str()};
+    std::remove(FileName.c_str());
+    return data;
+}
+
+void WriteRandomPalletData(
+    std::string const& fileName,
+    std::size_t rows,
+    std::size_t columns,
+    std::uint32_t seed)
+{
+    std::mt19937 rng{seed};
+    std::uniform_real_distribution<> value{0.0, 100.0};
+    std::normal_distribution<> noise{0.0, 10.0};
+    std::vector<double> weights(columns);
+    for(auto& weight: weights)
+        weight = std::uniform_real_distribution<>{-1.0, 1.0}(rng);
+
+    std::ofstream file{fileName};
+    std::vector<double> row(columns);
+    for(std::size_t i{}; i != rows; ++i)
+    {
+        for(auto& x: row)
+            x = value(rng);
+        file << std::inner_product(
+            row.cbegin(),
+            row.cend(),
+            weights.cbegin(),
+            100.0 + noise(rng));
+        for(auto x: row)
+            file << ',' << x;
+        file << '\n';
+    }
+}
+
+#endif // !CS3910__BENCH_H_
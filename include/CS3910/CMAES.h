@@ -0,0 +1,447 @@
+#ifndef CS3910__CMAES_H_
+#define CS3910__CMAES_H_
+
+#include "PSO.h"
+#include <algorithm>
+#include <cmath>
+#include <execution>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace internal
+{
+    // Eigen decomposition of the symmetric n by n row-major matrix A using
+    // cyclic Jacobi rotations. A is destroyed, its eigenvalues are written to
+    // values and the eigenvectors to the columns of vectors.
+    void SymmetricEigen(
+        std::vector<double>& a,
+        std::vector<double>& values,
+        std::vector<double>& vectors,
+        std::size_t n)
+    {
+        vectors.assign(n * n, 0.0);
+        for(std::size_t i{}; i != n; ++i)
+            vectors[i * n + i] = 1.0;
+
+        for(std::size_t sweep{}; sweep != 64; ++sweep)
+        {
+            double offDiagonal{};
+            for(std::size_t i{}; i != n; ++i)
+                for(auto j = i + 1; j != n; ++j)
+                    offDiagonal += a[i * n + j] * a[i * n + j];
+            if(offDiagonal < 1e-30)
+                break;
+
+            for(std::size_t p{}; p != n; ++p)
+                for(auto q = p + 1; q != n; ++q)
+                {
+                    auto const Apq = a[p * n + q];
+                    if(std::abs(Apq) < 1e-300)
+                        continue;
+
+                    auto const Theta = (a[q * n + q] - a[p * n + p])
+                        / (2 * Apq);
+                    auto const T = (Theta < 0 ? -1.0 : 1.0)
+                        / (std::abs(Theta) + std::sqrt(Theta * Theta + 1));
+                    auto const C = 1 / std::sqrt(T * T + 1);
+                    auto const S = T * C;
+
+                    for(std::size_t k{}; k != n; ++k)
+                    {
+                        auto const Akp = a[k * n + p];
+                        auto const Akq = a[k * n + q];
+                        a[k * n + p] = C * Akp - S * Akq;
+                        a[k * n + q] = S * Akp + C * Akq;
+                    }
+                    for(std::size_t k{}; k != n; ++k)
+                    {
+                        auto const Apk = a[p * n + k];
+                        auto const Aqk = a[q * n + k];
+                        a[p * n + k] = C * Apk - S * Aqk;
+                        a[q * n + k] = S * Apk + C * Aqk;
+                    }
+                    for(std::size_t k{}; k != n; ++k)
+                    {
+                        auto const Vkp = vectors[k * n + p];
+                        auto const Vkq = vectors[k * n + q];
+                        vectors[k * n + p] = C * Vkp - S * Vkq;
+                        vectors[k * n + q] = S * Vkp + C * Vkq;
+                    }
+                }
+        }
+
+        values.resize(n);
+        for(std::size_t i{}; i != n; ++i)
+            values[i] = a[i * n + i];
+    }
+}
+
+// Covariance matrix adaptation evolution strategy. The control policy is the
+// same as for BasicPSO: Init seeds the first population (whose best member
+// and spread give the starting mean and step size) and Evaluate scores a
+// sample stored as the position of a particle. Update is not used.
+// The search stops after the given number of iterations or once it has
+// converged, by the tolX and tolFun criteria of Hansen's reference code.
+template<typename EnvT, typename ControlPolicy>
+class BasicCMAES: private ControlPolicy
+{
+public:
+    struct Result
+    {
+        std::vector<double> position;
+        double fitness;
+    };
+
+    // A population size of 0 picks the default 4 + 3 ln(n).
+    explicit BasicCMAES(
+        EnvT const& env,
+        std::size_t populationSize = 0,
+        std::size_t iterations = 10000);
+
+    void Initialise();
+
+    void Step();
+
+    bool Terminate() noexcept;
+
+    // Evaluates the final mean and returns it if it beats the best sample.
+    Result Complete();
+
+private:
+    // Configuration
+    // Stop once every coordinate moves less than TolX times the starting
+    // step size, or once the fitness of the last generations varies by less
+    // than TolFun.
+    constexpr static double TolX = 1e-12;
+    constexpr static double TolFun = 1e-12;
+
+    static std::size_t DefaultPopulationSize(std::size_t n) noexcept
+    {
+        return 4 + static_cast<std::size_t>(3 * std::log(n));
+    }
+
+    void Decompose();
+
+    bool Converged(std::vector<double> const& fitness);
+
+    std::size_t const N_;
+
+    Particles samples_;
+
+    std::mt19937_64 rng_{};
+
+    // Strategy parameters
+    std::vector<double> weights_;
+    double muEff_{};
+    double cc_{};
+    double cs_{};
+    double c1_{};
+    double cMu_{};
+    double damps_{};
+    double chiN_{};
+
+    // Dynamic state
+    std::vector<double> mean_;
+    double sigma_{};
+    std::vector<double> pc_;
+    std::vector<double> ps_;
+    std::vector<double> c_;
+    std::vector<double> b_;
+    std::vector<double> d_;
+    std::vector<double> z_;
+    std::vector<std::size_t> order_;
+    std::size_t lastDecomposition_{};
+    double sigma0_{};
+    std::vector<double> bestHistory_;
+    bool converged_{};
+
+    double bestFitness_ = ControlPolicy::StartingFitness;
+
+    std::vector<double> bestPosition_;
+
+    std::size_t iteration_{};
+
+    std::size_t const MaxIteration_;
+};
+
+template<typename EnvT, typename ControlPolicy>
+BasicCMAES<EnvT, ControlPolicy>::BasicCMAES(
+    EnvT const& env,
+    std::size_t populationSize,
+    std::size_t iterations)
+    : ControlPolicy{ env }
+    , N_{ ControlPolicy::Dimension() }
+    , samples_{
+        populationSize != 0 ? populationSize : DefaultPopulationSize(N_),
+        N_ }
+    , MaxIteration_{ iterations }
+{
+    auto const Lambda = samples_.PopulationSize();
+    auto const Mu = Lambda / 2;
+    for(std::size_t i{}; i != Mu; ++i)
+        weights_.push_back(std::log(Mu + 0.5) - std::log(i + 1.0));
+    auto const Sum = std::accumulate(weights_.begin(), weights_.end(), 0.0);
+    std::for_each(weights_.begin(), weights_.end(), [&](auto& w) { w /= Sum; });
+    muEff_ = 1 / std::inner_product(
+        weights_.begin(),
+        weights_.end(),
+        weights_.begin(),
+        0.0);
+
+    auto const N = static_cast<double>(N_);
+    cc_ = (4 + muEff_ / N) / (N + 4 + 2 * muEff_ / N);
+    cs_ = (muEff_ + 2) / (N + muEff_ + 5);
+    c1_ = 2 / ((N + 1.3) * (N + 1.3) + muEff_);
+    cMu_ = std::min(
+        1 - c1_,
+        2 * (muEff_ - 2 + 1 / muEff_) / ((N + 2) * (N + 2) + muEff_));
+    damps_ = 1 + 2 * std::max(0.0, std::sqrt((muEff_ - 1) / (N + 1)) - 1)
+        + cs_;
+    chiN_ = std::sqrt(N) * (1 - 1 / (4 * N) + 1 / (21 * N * N));
+}
+
+template<typename EnvT, typename ControlPolicy>
+void BasicCMAES<EnvT, ControlPolicy>::Initialise()
+{
+    bestFitness_ = ControlPolicy::StartingFitness;
+    iteration_ = 0;
+    rng_.seed(std::random_device{}());
+
+    ControlPolicy::Init(samples_);
+
+    // Start from the best seed with a step size matching the spread of the
+    // seeds.
+    auto const Lambda = samples_.PopulationSize();
+    auto const Best = samples_.FindBest(ControlPolicy::Compare);
+    bestFitness_ = Best.bestFitness;
+    bestPosition_.assign(Best.bestPosition, Best.bestPosition + N_);
+    mean_ = bestPosition_;
+
+    std::vector<double> sum(N_);
+    std::vector<double> sumSquares(N_);
+    samples_.ForEach([&](auto&& p)
+    {
+        for(std::size_t j{}; j != N_; ++j)
+        {
+            sum[j] += p.position[j];
+            sumSquares[j] += p.position[j] * p.position[j];
+        }
+    });
+    double variance{};
+    for(std::size_t j{}; j != N_; ++j)
+        variance += sumSquares[j] / Lambda
+            - (sum[j] / Lambda) * (sum[j] / Lambda);
+    sigma_ = std::sqrt(std::max(variance / N_, 0.0));
+    if(!(0.0 < sigma_))
+        sigma_ = 0.5;
+    sigma0_ = sigma_;
+
+    pc_.assign(N_, 0.0);
+    ps_.assign(N_, 0.0);
+    c_.assign(N_ * N_, 0.0);
+    b_.assign(N_ * N_, 0.0);
+    d_.assign(N_, 1.0);
+    for(std::size_t i{}; i != N_; ++i)
+        c_[i * N_ + i] = b_[i * N_ + i] = 1.0;
+    z_.resize(Lambda * N_);
+    order_.resize(Lambda);
+    lastDecomposition_ = 0;
+    bestHistory_.clear();
+    converged_ = false;
+}
+
+template<typename EnvT, typename ControlPolicy>
+void BasicCMAES<EnvT, ControlPolicy>::Step()
+{
+    auto const Lambda = samples_.PopulationSize();
+
+    // Sample the population x = m + sigma B D z
+    std::generate(z_.begin(), z_.end(), [&]()
+    {
+        return std::normal_distribution<>{}(rng_);
+    });
+    samples_.ForAll([&](auto&& p)
+    {
+        auto const* z = z_.data() + p.id * N_;
+        std::copy(mean_.begin(), mean_.end(), p.position);
+        for(std::size_t k{}; k != N_; ++k)
+        {
+            auto const Scale = sigma_ * d_[k] * z[k];
+            for(std::size_t j{}; j != N_; ++j)
+                p.position[j] += Scale * b_[j * N_ + k];
+        }
+    });
+
+    // Batched evaluation of the whole population
+    samples_.ForAll([&](auto&& p)
+    {
+        p.bestFitness = ControlPolicy::StartingFitness;
+        p.fitness = this->Evaluate(p);
+        p.bestFitness = p.fitness;
+    });
+
+    std::vector<double const*> positions(Lambda);
+    std::vector<double> fitness(Lambda);
+    samples_.ForEach([&](auto&& p)
+    {
+        positions[p.id] = p.position;
+        fitness[p.id] = p.fitness;
+    });
+    std::iota(order_.begin(), order_.end(), std::size_t{});
+    std::sort(order_.begin(), order_.end(), [&](auto a, auto b)
+    {
+        return ControlPolicy::Compare(fitness[a], fitness[b]);
+    });
+
+    if(ControlPolicy::Compare(fitness[order_.front()], bestFitness_))
+    {
+        bestFitness_ = fitness[order_.front()];
+        bestPosition_.assign(
+            positions[order_.front()],
+            positions[order_.front()] + N_);
+    }
+
+    // Recombine the mu best samples into the new mean
+    auto const OldMean = mean_;
+    std::fill(mean_.begin(), mean_.end(), 0.0);
+    for(std::size_t i{}; i != weights_.size(); ++i)
+        for(std::size_t j{}; j != N_; ++j)
+            mean_[j] += weights_[i] * positions[order_[i]][j];
+
+    std::vector<double> step(N_);
+    for(std::size_t j{}; j != N_; ++j)
+        step[j] = (mean_[j] - OldMean[j]) / sigma_;
+
+    // Cumulate the evolution paths, C^-1/2 = B D^-1 B^T
+    std::vector<double> whitened(N_);
+    for(std::size_t k{}; k != N_; ++k)
+    {
+        double x{};
+        for(std::size_t j{}; j != N_; ++j)
+            x += b_[j * N_ + k] * step[j];
+        whitened[k] = x / d_[k];
+    }
+    auto const Cs = std::sqrt(cs_ * (2 - cs_) * muEff_);
+    for(std::size_t j{}; j != N_; ++j)
+    {
+        double x{};
+        for(std::size_t k{}; k != N_; ++k)
+            x += b_[j * N_ + k] * whitened[k];
+        ps_[j] = (1 - cs_) * ps_[j] + Cs * x;
+    }
+
+    auto const PsNorm = std::sqrt(std::inner_product(
+        ps_.begin(),
+        ps_.end(),
+        ps_.begin(),
+        0.0));
+    // Terminate has counted this generation already, the first is 1
+    auto const Generation = std::max<std::size_t>(iteration_, 1);
+    auto const HSigma = PsNorm
+        / std::sqrt(1 - std::pow(1 - cs_, 2.0 * Generation))
+        / chiN_ < 1.4 + 2 / (N_ + 1.0);
+    auto const Cc = std::sqrt(cc_ * (2 - cc_) * muEff_);
+    for(std::size_t j{}; j != N_; ++j)
+        pc_[j] = (1 - cc_) * pc_[j] + HSigma * Cc * step[j];
+
+    // Rank one and rank mu update of the covariance
+    auto const Decay = 1 - c1_ - cMu_
+        + (1 - HSigma) * c1_ * cc_ * (2 - cc_);
+    std::for_each(c_.begin(), c_.end(), [&](auto& c) { c *= Decay; });
+    for(std::size_t i{}; i != N_; ++i)
+        for(std::size_t j{}; j <= i; ++j)
+            c_[i * N_ + j] += c1_ * pc_[i] * pc_[j];
+    std::vector<double> y(N_);
+    for(std::size_t r{}; r != weights_.size(); ++r)
+    {
+        auto const* x = positions[order_[r]];
+        for(std::size_t j{}; j != N_; ++j)
+            y[j] = (x[j] - OldMean[j]) / sigma_;
+        auto const W = cMu_ * weights_[r];
+        for(std::size_t i{}; i != N_; ++i)
+            for(std::size_t j{}; j <= i; ++j)
+                c_[i * N_ + j] += W * y[i] * y[j];
+    }
+    for(std::size_t i{}; i != N_; ++i)
+        for(std::size_t j{}; j != i; ++j)
+            c_[j * N_ + i] = c_[i * N_ + j];
+
+    sigma_ *= std::exp((cs_ / damps_) * (PsNorm / chiN_ - 1));
+
+    // Only decompose the covariance every few iterations, it changes slowly
+    auto const Gap = Lambda / ((c1_ + cMu_) * N_ * 10);
+    if(Gap < iteration_ - lastDecomposition_)
+    {
+        Decompose();
+        lastDecomposition_ = iteration_;
+    }
+
+    converged_ = Converged(fitness);
+}
+
+template<typename EnvT, typename ControlPolicy>
+bool BasicCMAES<EnvT, ControlPolicy>::Converged(
+    std::vector<double> const& fitness)
+{
+    // tolX: the evolution path and the standard deviation in every
+    // coordinate are negligible next to the starting step size
+    auto converged = true;
+    for(std::size_t j{}; j != N_ && converged; ++j)
+        converged = sigma_ * std::abs(pc_[j]) < TolX * sigma0_
+            && sigma_ * std::sqrt(c_[j * N_ + j]) < TolX * sigma0_;
+    if(converged)
+        return true;
+
+    // tolFun: the best fitness of the last 10 + 30n/lambda generations and
+    // the fitness of the whole current generation lie within TolFun
+    auto const Lambda = samples_.PopulationSize();
+    auto const History = 10 + (30 * N_ + Lambda - 1) / Lambda;
+    bestHistory_.push_back(fitness[order_.front()]);
+    if(History < bestHistory_.size())
+        bestHistory_.erase(bestHistory_.begin());
+    if(bestHistory_.size() < History)
+        return false;
+
+    auto const [Low, High] = std::minmax_element(
+        bestHistory_.begin(),
+        bestHistory_.end());
+    auto const Spread = std::max(*High, fitness[order_.back()])
+        - std::min(*Low, fitness[order_.front()]);
+    return Spread < TolFun;
+}
+
+template<typename EnvT, typename ControlPolicy>
+void BasicCMAES<EnvT, ControlPolicy>::Decompose()
+{
+    auto a = c_;
+    internal::SymmetricEigen(a, d_, b_, N_);
+    std::for_each(d_.begin(), d_.end(), [](auto& d)
+    {
+        d = std::sqrt(std::max(d, 1e-300));
+    });
+}
+
+template<typename EnvT, typename ControlPolicy>
+bool BasicCMAES<EnvT, ControlPolicy>::Terminate() noexcept
+{
+    return converged_ || MaxIteration_ < ++iteration_;
+}
+
+template<typename EnvT, typename ControlPolicy>
+typename BasicCMAES<EnvT, ControlPolicy>::Result
+BasicCMAES<EnvT, ControlPolicy>::Complete()
+{
+    // The mean is an estimate of the optimum that is never evaluated while
+    // sampling, score it in the slot of one of the samples.
+    auto sample = samples_.FindBest(ControlPolicy::Compare);
+    std::copy(mean_.begin(), mean_.end(), sample.position);
+    sample.bestFitness = ControlPolicy::StartingFitness;
+    auto const Fitness = this->Evaluate(sample);
+    if(ControlPolicy::Compare(Fitness, bestFitness_))
+        return { mean_, Fitness };
+    return { bestPosition_, bestFitness_ };
+}
+
+#endif // !CS3910__CMAES_H_
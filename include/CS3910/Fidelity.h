@@ -0,0 +1,130 @@
+#ifndef CS3910__FIDELITY_H_
+#define CS3910__FIDELITY_H_
+
+#include "Pallets.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <execution>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// Cheaper stand-ins for the full data, good enough to rank candidates early
+// in a run. A subsample is drawn afresh whenever it is needed, a coreset is
+// built once and weighted so that its mean error follows that of the data.
+
+// A sample of distinct rows of the data chosen at random.
+template<typename RngT>
+PalletData Subsample(PalletData const& data, std::size_t size, RngT& rng)
+{
+    std::vector<std::size_t> rows(data.RowCount());
+    std::iota(rows.begin(), rows.end(), std::size_t{});
+    size = std::min(size, rows.size());
+    for(std::size_t i{}; i != size; ++i)
+        std::swap(rows[i], rows[std::uniform_int_distribution<std::size_t>{
+            i,
+            rows.size() - 1}(rng)]);
+    rows.resize(size);
+    std::sort(rows.begin(), rows.end());
+    return PalletData{data, rows};
+}
+
+// A weighted sample of representative rows. The rows are picked by k-means++
+// seeding over the data and the demand, each scaled by its spread, so rows
+// far from those already picked are more likely. Every row of the data is
+// then given to its nearest pick, which weighs as many rows as it was given.
+// Takes time in the size of the coreset times the size of the data.
+template<typename RngT>
+PalletData Coreset(PalletData const& data, std::size_t size, RngT& rng)
+{
+    auto const Rows = data.RowCount();
+    auto const Count = data.DataCount();
+    size = std::min(size, Rows);
+
+    // Every row as a point with the demand as its last coordinate
+    std::vector<double> points((Count + 1) * Rows);
+    for(std::size_t j{}; j <= Count; ++j)
+    {
+        auto const First = j == Count
+            ? data.BeginDemand()
+            : data.BeginColumn(j);
+        auto const Mean = std::accumulate(First, First + Rows, 0.0) / Rows;
+        auto const Variance = std::accumulate(
+            First,
+            First + Rows,
+            0.0,
+            [&](auto acc, auto x) { return acc + (x - Mean) * (x - Mean); })
+            / Rows;
+        auto const Scale = 0.0 < Variance ? 1 / std::sqrt(Variance) : 0.0;
+        for(std::size_t i{}; i != Rows; ++i)
+            points[i * (Count + 1) + j] = (First[i] - Mean) * Scale;
+    }
+
+    std::vector<std::size_t> picks{};
+    std::vector<std::size_t> nearest(Rows);
+    std::vector<double> distances(
+        Rows,
+        std::numeric_limits<double>::infinity());
+    std::vector<std::size_t> rowIds(Rows);
+    std::iota(rowIds.begin(), rowIds.end(), std::size_t{});
+    auto pick = std::uniform_int_distribution<std::size_t>{0, Rows - 1}(rng);
+    while(picks.size() != size)
+    {
+        auto const* pickedPoint = points.data() + pick * (Count + 1);
+        auto const Id = picks.size();
+        picks.push_back(pick);
+        std::for_each(
+            std::execution::par,
+            rowIds.cbegin(),
+            rowIds.cend(),
+            [&](auto i) noexcept
+            {
+                auto const* point = points.data() + i * (Count + 1);
+                double distance{};
+                for(std::size_t j{}; j <= Count; ++j)
+                    distance += (point[j] - pickedPoint[j])
+                        * (point[j] - pickedPoint[j]);
+                if(distance < distances[i])
+                {
+                    distances[i] = distance;
+                    nearest[i] = Id;
+                }
+            });
+
+        // The next pick in proportion to the squared distance, every row
+        // left is a copy of a pick once the distances are all zero
+        auto const Total = std::accumulate(
+            distances.cbegin(),
+            distances.cend(),
+            0.0);
+        if(!(0.0 < Total))
+            break;
+        pick = std::discrete_distribution<std::size_t>{
+            distances.cbegin(),
+            distances.cend()}(rng);
+    }
+
+    std::vector<double> weights(picks.size());
+    for(auto i: nearest)
+        ++weights[i];
+    return PalletData{data, picks, weights};
+}
+
+// The fraction of the rows to evaluate on in an iteration of a run. It rises
+// geometrically from the minimum to all of the rows after rampLength
+// iterations.
+double Fidelity(
+    std::size_t iteration,
+    std::size_t rampLength,
+    double minFidelity)
+{
+    if(rampLength <= iteration)
+        return 1.0;
+    return minFidelity * std::pow(
+        1 / minFidelity,
+        static_cast<double>(iteration) / rampLength);
+}
+
+#endif // !CS3910__FIDELITY_H_
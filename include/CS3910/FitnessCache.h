@@ -0,0 +1,170 @@
+#ifndef CS3910__FITNESS_CACHE_H_
+#define CS3910__FITNESS_CACHE_H_
+
+#include "GP.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// A bounded cache from expressions to their fitness which may be used from
+// several threads at once. The cache is split into shards by the structural
+// hash of the expressions, each with its own lock, and a full shard forgets
+// its oldest entries first. The expressions are kept so that a hash
+// collision is never mistaken for a hit.
+class FitnessCache final
+{
+public:
+    explicit FitnessCache(std::size_t capacity, std::size_t shardCount = 16);
+
+    // Find the fitness of an expression, counting a hit or a miss.
+    std::optional<double> Find(ExprView expr);
+
+    // Find the fitness of an expression whose hash, see ExprView::Hash, is
+    // known, so that an expression looked up and then inserted is hashed
+    // once.
+    std::optional<double> Find(ExprView expr, std::uint64_t hash);
+
+    void Insert(ExprView expr, double fitness);
+
+    void Insert(ExprView expr, std::uint64_t hash, double fitness);
+
+    void Clear();
+
+    std::size_t Hits() const;
+
+    std::size_t Misses() const;
+
+    // The fraction of lookups which were hits.
+    double HitRate() const;
+
+private:
+    struct Entry
+    {
+        Expr function;
+        double fitness;
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mutex{};
+        std::unordered_map<std::uint64_t, Entry> entries{};
+        std::deque<std::uint64_t> order{};
+        std::size_t hits{};
+        std::size_t misses{};
+    };
+
+    Shard& ShardOf(std::uint64_t hash) const noexcept;
+
+    std::unique_ptr<Shard[]> shards_;
+
+    std::size_t shardCount_;
+
+    std::size_t shardCapacity_;
+};
+
+FitnessCache::FitnessCache(std::size_t capacity, std::size_t shardCount)
+    : shards_{std::make_unique<Shard[]>(shardCount)}
+    , shardCount_{shardCount}
+    , shardCapacity_{(capacity + shardCount - 1) / shardCount}
+{
+}
+
+std::optional<double> FitnessCache::Find(ExprView expr)
+{
+    return Find(expr, expr.Hash());
+}
+
+std::optional<double> FitnessCache::Find(ExprView expr, std::uint64_t hash)
+{
+    assert(hash == expr.Hash() && "The hash is not of the expression");
+    auto& shard = ShardOf(hash);
+    std::lock_guard<std::mutex> lock{shard.mutex};
+    auto const It = shard.entries.find(hash);
+    if(It == shard.entries.end() || ExprView{It->second.function} != expr)
+    {
+        ++shard.misses;
+        return std::nullopt;
+    }
+
+    ++shard.hits;
+    return It->second.fitness;
+}
+
+void FitnessCache::Insert(ExprView expr, double fitness)
+{
+    Insert(expr, expr.Hash(), fitness);
+}
+
+void FitnessCache::Insert(ExprView expr, std::uint64_t hash, double fitness)
+{
+    assert(hash == expr.Hash() && "The hash is not of the expression");
+    auto& shard = ShardOf(hash);
+    std::lock_guard<std::mutex> lock{shard.mutex};
+    auto [it, inserted] = shard.entries.insert_or_assign(
+        hash,
+        Entry{Expr{expr}, fitness});
+    if(!inserted)
+        return;
+
+    shard.order.push_back(hash);
+    while(shardCapacity_ < shard.entries.size())
+    {
+        shard.entries.erase(shard.order.front());
+        shard.order.pop_front();
+    }
+}
+
+void FitnessCache::Clear()
+{
+    for(std::size_t i{}; i != shardCount_; ++i)
+    {
+        std::lock_guard<std::mutex> lock{shards_[i].mutex};
+        shards_[i].entries.clear();
+        shards_[i].order.clear();
+        shards_[i].hits = 0;
+        shards_[i].misses = 0;
+    }
+}
+
+std::size_t FitnessCache::Hits() const
+{
+    std::size_t hits{};
+    for(std::size_t i{}; i != shardCount_; ++i)
+    {
+        std::lock_guard<std::mutex> lock{shards_[i].mutex};
+        hits += shards_[i].hits;
+    }
+
+    return hits;
+}
+
+std::size_t FitnessCache::Misses() const
+{
+    std::size_t misses{};
+    for(std::size_t i{}; i != shardCount_; ++i)
+    {
+        std::lock_guard<std::mutex> lock{shards_[i].mutex};
+        misses += shards_[i].misses;
+    }
+
+    return misses;
+}
+
+double FitnessCache::HitRate() const
+{
+    auto const Found = Hits();
+    auto const Total = Found + Misses();
+    return Total == 0 ? 0.0 : static_cast<double>(Found) / Total;
+}
+
+FitnessCache::Shard& FitnessCache::ShardOf(std::uint64_t hash) const noexcept
+{
+    return shards_[hash % shardCount_];
+}
+
+#endif // !CS3910__FITNESS_CACHE_H_
@@ -1,16 +1,31 @@
 #ifndef CS3910__GP_H_
 #define CS3910__GP_H_
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <numeric>
 #include <ostream>
+#include <utility>
 #include <vector>
 #include <random>
 
+// A closed range of values, an infinite bound is unbounded unless both bounds
+// are the same infinity.
+struct Interval
+{
+    double lo;
+    double hi;
+};
+
 namespace internal
 {
-    enum OpCode: std::uint64_t
+    enum OpCode: std::uint8_t
     {
         LoadConst,
         LoadArg,
@@ -20,7 +35,46 @@ namespace internal
         Div
     };
 
-    int PrecOf(std::uint64_t op)
+    // A node of a prefix expression. The argument is the column read by a
+    // LoadArg, the values of LoadConst nodes are kept in a separate constant
+    // pool in the order they appear in the expression.
+    struct Instr
+    {
+        std::uint8_t op;
+        std::uint16_t arg;
+    };
+
+    constexpr bool operator==(Instr a, Instr b) noexcept
+    {
+        return a.op == b.op && a.arg == b.arg;
+    }
+
+    constexpr bool operator!=(Instr a, Instr b) noexcept
+    {
+        return !(a == b);
+    }
+
+    constexpr bool IsTerminal(std::uint8_t op) noexcept
+    {
+        return op == OpCode::LoadConst || op == OpCode::LoadArg;
+    }
+
+    // The number of nodes and of constants of the subtree rooted at a node,
+    // and the depth of the node and the number of constants before it. An
+    // expression keeps the extent of every node alongside its code. The size
+    // and constants only depend on the subtree and are copied with it, the
+    // depth and offset are read relative to the first node of the code, so
+    // they hold for a view of a subtree too, and are placed again when an
+    // expression is spliced together, see PlaceExpr.
+    struct Extent
+    {
+        std::uint32_t size;
+        std::uint32_t consts;
+        std::uint32_t depth{};
+        std::uint32_t constOffset{};
+    };
+
+    int PrecOf(std::uint8_t op)
     {
         switch(op)
         {
@@ -37,7 +91,7 @@ namespace internal
         return -1;
     }
 
-    std::ostream& PrintInfix(std::uint64_t op, std::ostream& outs)
+    std::ostream& PrintInfix(std::uint8_t op, std::ostream& outs)
     {
         switch (op)
         {
@@ -56,119 +110,378 @@ namespace internal
 
     // Find the exclusive end of a prefix expressions
     template<typename ForwardIt>
-    ForwardIt EndOfExpr(ForwardIt first, ForwardIt last)
+    ForwardIt EndOfExpr(ForwardIt first, [[maybe_unused]] ForwardIt last)
     {
         assert(first != last && "Cannot find the end of an empty Expr");
-        switch (*(first++))
+        for(std::size_t open{1}; open != 0; ++first)
         {
-        case OpCode::LoadConst:
-        case OpCode::LoadArg:
-            return ++first;
-        case OpCode::Add:
-        case OpCode::Sub:
-        case OpCode::Mul:
-        case OpCode::Div:
-            auto i = EndOfExpr(first, last);
-            i = EndOfExpr(i, last);
-            return i;
+            assert(first != last && "Incomplete Expr");
+            open = IsTerminal(first->op) ? open - 1 : open + 1;
         }
 
-        // Unreachable!!
-        return last;
+        return first;
     }
 
-    // Evaluate a prefix expression
-    template<typename ForwardIt, typename RandomIt>
-    std::pair<double, ForwardIt> EvalExpr(
-        ForwardIt first,
-        ForwardIt last,
-        RandomIt argIt)
+    // Count the constants of a prefix expression
+    template<typename ForwardIt>
+    std::size_t CountConsts(ForwardIt first, ForwardIt last)
     {
-        assert(first != last && "Cannot evaluate an empty Expr");
-        switch (*first)
+        return static_cast<std::size_t>(std::count_if(
+            first,
+            last,
+            [](auto const& instr)
+            {
+                return instr.op == OpCode::LoadConst;
+            }));
+    }
+
+    // Find the largest number of values on the stack when evaluating a
+    // prefix expression.
+    template<typename BidirIt>
+    std::size_t StackDepthExpr(BidirIt first, BidirIt last)
+    {
+        std::size_t depth{};
+        std::size_t maxDepth{};
+        while(first != last)
+            if(IsTerminal((--last)->op))
+                maxDepth = std::max(maxDepth, ++depth);
+            else
+                --depth;
+        return maxDepth;
+    }
+
+    // Write the depth and the constant offset of every node of an expression
+    // whose sizes and constants are already known. Running the code forwards
+    // reaches a node before both of its children.
+    template<typename RandomIt>
+    void PlaceExpr(RandomIt first, RandomIt last)
+    {
+        if(first == last)
+            return;
+
+        first->depth = 0;
+        first->constOffset = 0;
+        for(auto node = first; node != last; ++node)
         {
-        case OpCode::LoadConst:
+            if(node->size == 1)
+                continue;
+
+            auto const Lhs = std::next(node);
+            auto const Rhs = Lhs + Lhs->size;
+            Lhs->depth = Rhs->depth = node->depth + 1;
+            Lhs->constOffset = node->constOffset;
+            Rhs->constOffset = node->constOffset + Lhs->consts;
+        }
+    }
+
+    // Write the extent of every node of a prefix expression. Running the code
+    // backwards reaches both children of a node before the node itself.
+    template<typename BidirIt, typename RandomOutIt>
+    void IndexExpr(BidirIt first, BidirIt last, RandomOutIt outIt)
+    {
+        auto const Count = std::distance(first, last);
+        outIt += Count;
+        while(first != last)
+        {
+            --last;
+            --outIt;
+            if(IsTerminal(last->op))
             {
-                double temp;
-                std::memcpy(&temp, &*std::next(first), 8);
-                return {temp, std::next(first, 2)};
+                *outIt = Extent{1, last->op == OpCode::LoadConst};
+                continue;
             }
-        case OpCode::LoadArg:
-            return {argIt[*std::next(first)], std::next(first, 2)};
-        case OpCode::Add:
+
+            auto const Lhs = outIt[1];
+            auto const Rhs = outIt[1 + Lhs.size];
+            *outIt = Extent{
+                1 + Lhs.size + Rhs.size,
+                Lhs.consts + Rhs.consts};
+        }
+
+        PlaceExpr(outIt, outIt + Count);
+    }
+
+    // Walk from the root of an expression down to a node, calling f with
+    // every ancestor of the node. Returns the number of constants before
+    // the node.
+    template<typename F>
+    std::size_t DescendExpr(Extent const* extents, std::size_t id, F&& f)
+    {
+        std::size_t node{};
+        std::size_t consts{};
+        while(node != id)
+        {
+            f(node);
+            auto const Lhs = node + 1;
+            if(id < Lhs + extents[Lhs].size)
+                node = Lhs;
+            else
             {
-                auto [lhsVal, lhsEnd] = EvalExpr(std::next(first), last, argIt);
-                auto [rhsVal, rhsEnd] = EvalExpr(lhsEnd, last, argIt);
-                return {lhsVal + rhsVal, rhsEnd};
+                consts += extents[Lhs].consts;
+                node = Lhs + extents[Lhs].size;
             }
-        case OpCode::Sub:
+        }
+
+        return consts;
+    }
+
+    // Evaluate a prefix expression with a stack machine. Running the code
+    // backwards visits the nodes in postfix order, so both operands of a
+    // node are on the stack when it is reached, the left hand side on top.
+    // The constants are read backwards from the end of the constants of the
+    // expression. The stack must hold StackDepthExpr values.
+    template<typename BidirIt, typename BidirConstIt, typename RandomIt>
+    double EvalExpr(
+        BidirIt first,
+        BidirIt last,
+        BidirConstIt constLast,
+        RandomIt argIt,
+        double* stack)
+    {
+        assert(first != last && "Cannot evaluate an empty Expr");
+        auto top = stack;
+        while(first != last)
+        {
+            --last;
+            switch (last->op)
             {
-                auto [lhsVal, lhsEnd] = EvalExpr(std::next(first), last, argIt);
-                auto [rhsVal, rhsEnd] = EvalExpr(lhsEnd, last, argIt);
-                return {lhsVal - rhsVal, rhsEnd};
+            case OpCode::LoadConst:
+                *top++ = *--constLast;
+                break;
+            case OpCode::LoadArg:
+                *top++ = argIt[last->arg];
+                break;
+            case OpCode::Add:
+                --top;
+                top[-1] = *top + top[-1];
+                break;
+            case OpCode::Sub:
+                --top;
+                top[-1] = *top - top[-1];
+                break;
+            case OpCode::Mul:
+                --top;
+                top[-1] = *top * top[-1];
+                break;
+            case OpCode::Div:
+                --top;
+                // Protected division...
+                top[-1] = top[-1] == 0.0
+                    ? std::numeric_limits<double>::infinity()
+                    : *top / top[-1];
+                break;
             }
+        }
+
+        return *stack;
+    }
+
+    // Apply an operator element-wise to count values, out may be the same
+    // as either of the operands.
+    void ApplyOp(
+        std::uint8_t op,
+        double const* lhs,
+        double const* rhs,
+        double* out,
+        std::size_t count)
+    {
+        switch (op)
+        {
+        case OpCode::Add:
+            for(std::size_t i{}; i != count; ++i)
+                out[i] = lhs[i] + rhs[i];
+            break;
+        case OpCode::Sub:
+            for(std::size_t i{}; i != count; ++i)
+                out[i] = lhs[i] - rhs[i];
+            break;
+        case OpCode::Mul:
+            for(std::size_t i{}; i != count; ++i)
+                out[i] = lhs[i] * rhs[i];
+            break;
+        case OpCode::Div:
+            // Protected division...
+            for(std::size_t i{}; i != count; ++i)
+                out[i] = rhs[i] == 0.0
+                    ? std::numeric_limits<double>::infinity()
+                    : lhs[i] / rhs[i];
+            break;
+        }
+    }
+
+    // Bound the result of an operator for operands within ranges, where an
+    // infinity is a value as from protected division. Dividing by exactly
+    // zero is always infinite, while dividing by a range which merely holds
+    // zero is unbounded, as is a bound which is not a number, such as the
+    // sum of infinities of opposite sign.
+    Interval IntervalOp(std::uint8_t op, Interval lhs, Interval rhs) noexcept
+    {
+        constexpr auto Inf = std::numeric_limits<double>::infinity();
+        Interval result{-Inf, Inf};
+        switch (op)
+        {
+        case OpCode::Add:
+            result = {lhs.lo + rhs.lo, lhs.hi + rhs.hi};
+            break;
+        case OpCode::Sub:
+            result = {lhs.lo - rhs.hi, lhs.hi - rhs.lo};
+            break;
+        case OpCode::Div:
+            if(rhs.lo == 0.0 && rhs.hi == 0.0)
+                return {Inf, Inf};
+            if(rhs.lo <= 0.0 && 0.0 <= rhs.hi)
+                return result;
+            [[fallthrough]];
         case OpCode::Mul:
+        {
+            // The extremes are at the ends of the ranges. They are divided
+            // rather than multiplied by a reciprocal so that they round as
+            // the values between them do.
+            auto const Div = op == OpCode::Div;
+            double const Ends[]{
+                Div ? lhs.lo / rhs.lo : lhs.lo * rhs.lo,
+                Div ? lhs.lo / rhs.hi : lhs.lo * rhs.hi,
+                Div ? lhs.hi / rhs.lo : lhs.hi * rhs.lo,
+                Div ? lhs.hi / rhs.hi : lhs.hi * rhs.hi};
+            if(std::none_of(
+                std::begin(Ends),
+                std::end(Ends),
+                [](auto x) noexcept { return std::isnan(x); }))
             {
-                auto [lhsVal, lhsEnd] = EvalExpr(std::next(first), last, argIt);
-                auto [rhsVal, rhsEnd] = EvalExpr(lhsEnd, last, argIt);
-                return {lhsVal * rhsVal, rhsEnd};
+                auto const [Lo, Hi] = std::minmax_element(
+                    std::begin(Ends),
+                    std::end(Ends));
+                result = {*Lo, *Hi};
             }
-        case OpCode::Div:
+            break;
+        }
+        }
+
+        if(std::isnan(result.lo) || std::isnan(result.hi))
+            return {-Inf, Inf};
+        return result;
+    }
+
+    // Bound the values of a prefix expression with the same stack machine
+    // as EvalExpr over ranges, see IntervalOp. The range of an argument is
+    // argRange(arg).
+    template<typename BidirIt, typename BidirConstIt, typename F>
+    Interval RangeExpr(
+        BidirIt first,
+        BidirIt last,
+        BidirConstIt constLast,
+        F&& argRange)
+    {
+        std::vector<Interval> stack{};
+        while(first != last)
+        {
+            --last;
+            switch (last->op)
+            {
+            case OpCode::LoadConst:
+                --constLast;
+                stack.push_back(Interval{*constLast, *constLast});
+                break;
+            case OpCode::LoadArg:
+                stack.push_back(argRange(last->arg));
+                break;
+            default:
+            {
+                auto const Lhs = stack.back();
+                stack.pop_back();
+                stack.back() = IntervalOp(last->op, Lhs, stack.back());
+            }
+            }
+        }
+
+        assert(stack.size() == 1 && "Malformed Expr");
+        return stack.back();
+    }
+
+    // The number of rows evaluated at once by the block interpreter.
+    constexpr std::size_t EvalBlockSize = 256;
+
+    // Evaluate a prefix expression over count rows starting at row with the
+    // same stack machine as EvalExpr, except that every stack entry is a
+    // block of EvalBlockSize values. The arguments are column-major with a
+    // stride between the columns. The stack must hold StackDepthExpr
+    // blocks.
+    template<typename BidirIt, typename BidirConstIt>
+    void EvalExprBlock(
+        BidirIt first,
+        BidirIt last,
+        BidirConstIt constLast,
+        double const* columns,
+        std::size_t stride,
+        std::size_t row,
+        std::size_t count,
+        double* out,
+        double* stack)
+    {
+        assert(first != last && "Cannot evaluate an empty Expr");
+        auto top = stack;
+        while(first != last)
+        {
+            --last;
+            if(IsTerminal(last->op))
             {
-                auto [lhsVal, lhsEnd] = EvalExpr(std::next(first), last, argIt);
-                auto [rhsVal, rhsEnd] = EvalExpr(lhsEnd, last, argIt);
-                if(rhsVal == 0.0)
-                    // Protected division...
-                    return {std::numeric_limits<double>::infinity(), rhsEnd};
+                if(last->op == OpCode::LoadConst)
+                    std::fill(top, top + count, *--constLast);
                 else
-                    return { lhsVal / rhsVal, rhsEnd };
+                {
+                    auto const* column = columns + last->arg * stride + row;
+                    std::copy(column, column + count, top);
+                }
+
+                top += EvalBlockSize;
+                continue;
             }
+
+            top -= EvalBlockSize;
+            auto* rhs = top - EvalBlockSize;
+            ApplyOp(last->op, top, rhs, rhs, count);
         }
 
-        // Unreachable!!
-        return {0.0, last};
+        std::copy(stack, stack + count, out);
     }
 
     // Print a prefix expression as infix
-    template<typename ForwardIt>
+    template<typename ForwardIt, typename ForwardConstIt>
     ForwardIt PrintExpr(
         ForwardIt first,
         ForwardIt last,
+        ForwardConstIt& constIt,
         std::ostream& outs)
     {
         assert(first != last && "Cannot print empty expression");
-        switch (*first)
+        switch (first->op)
         {
         case OpCode::LoadConst:
-            {
-                double temp;
-                std::memcpy(&temp, &*std::next(first), 8);
-                outs << temp;
-                return std::next(first, 2);
-            }
+            outs << *constIt++;
+            return std::next(first);
         case OpCode::LoadArg:
-            outs << 'x' << *std::next(first);
-            return std::next(first, 2);
+            outs << 'x' << first->arg;
+            return std::next(first);
             
         case OpCode::Add:
         case OpCode::Sub:
         case OpCode::Mul:
         case OpCode::Div:
             {
-                auto const Op = *first;
+                auto const Op = first->op;
                 ++first;
-                if(PrecOf(*first) < PrecOf(Op))
+                if(PrecOf(first->op) < PrecOf(Op))
                     outs << '(';
-                auto lhsEnd = PrintExpr(first, last, outs);
-                if (PrecOf(*first) < PrecOf(Op))
+                auto lhsEnd = PrintExpr(first, last, constIt, outs);
+                if (PrecOf(first->op) < PrecOf(Op))
                     outs << ')';
                 
                 PrintInfix(Op, outs);
                 
-                if(PrecOf(*lhsEnd) < PrecOf(Op))
+                if(PrecOf(lhsEnd->op) < PrecOf(Op))
                     outs << '(';
-                auto rhsEnd = PrintExpr(lhsEnd, last, outs);
-                if (PrecOf(*lhsEnd) < PrecOf(Op))
+                auto rhsEnd = PrintExpr(lhsEnd, last, constIt, outs);
+                if (PrecOf(lhsEnd->op) < PrecOf(Op))
                     outs << ')';
                 return rhsEnd;
             }
@@ -177,177 +490,1110 @@ namespace internal
         return last;
     }
 
-    // Count the total number of terminals and non-terminals in a prefix
-    // expressions
-    template<typename ForwardIt>
-    std::size_t CountExpr(ForwardIt first, ForwardIt last)
+    // Combine two hashes, based on the finaliser of splitmix64.
+    constexpr std::uint64_t HashCombine(
+        std::uint64_t seed,
+        std::uint64_t x) noexcept
+    {
+        x += 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2);
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return seed ^ x ^ (x >> 31);
+    }
+
+    // Hash a single node given the hashes of its operands.
+    constexpr std::uint64_t HashNode(
+        Instr instr,
+        std::uint64_t payload,
+        std::uint64_t lhs,
+        std::uint64_t rhs) noexcept
+    {
+        auto const Node = HashCombine(instr.op, instr.arg);
+        return HashCombine(HashCombine(HashCombine(Node, payload), lhs), rhs);
+    }
+
+    // Structurally hash a prefix expression. The hash of every subtree is
+    // combined from the hashes of its operands, computed with the same
+    // stack machine as EvalExpr, so equal subtrees have equal hashes
+    // wherever they appear. The stack is scratch space, which keeps its
+    // memory from one expression to the next.
+    template<typename BidirIt, typename BidirConstIt>
+    std::uint64_t HashExpr(
+        BidirIt first,
+        BidirIt last,
+        BidirConstIt constLast,
+        std::vector<std::uint64_t>& stack)
     {
-        std::size_t count{};
-        while(first != last) {
-            ++count;
-            switch (*first)
+        stack.clear();
+        while(first != last)
+        {
+            --last;
+            if(IsTerminal(last->op))
             {
-            case OpCode::LoadConst:
-            case OpCode::LoadArg:
-                first += 2;
-                break;
-            case OpCode::Add:
-            case OpCode::Sub:
-            case OpCode::Mul:
-            case OpCode::Div:
-                ++first;
-                break;
+                std::uint64_t payload{};
+                if(last->op == OpCode::LoadConst)
+                    std::memcpy(&payload, &*--constLast, sizeof(payload));
+                stack.push_back(HashNode(*last, payload, 0, 0));
+                continue;
             }
+
+            auto const Lhs = stack.back();
+            stack.pop_back();
+            stack.back() = HashNode(*last, 0, Lhs, stack.back());
         }
 
-        return count;
+        return stack.empty() ? 0 : stack.back();
     }
 
-    // Find a terminal or non-terminal in the prefix expression by traversing
-    // the tree in deptht-first order. The id of a node corresponds to it's
-    // order of visitation.
-    template<typename ForwardIt>
-    ForwardIt FindExpr(ForwardIt first, ForwardIt last, std::size_t id)
+    // Apply an operator to two values the same way as the interpreter.
+    double ApplyOp(std::uint8_t op, double lhs, double rhs) noexcept
+    {
+        switch (op)
+        {
+        case OpCode::Add:
+            return lhs + rhs;
+        case OpCode::Sub:
+            return lhs - rhs;
+        case OpCode::Mul:
+            return lhs * rhs;
+        case OpCode::Div:
+            // Protected division...
+            return rhs == 0.0
+                ? std::numeric_limits<double>::infinity()
+                : lhs / rhs;
+        }
+
+        return 0.0;
+    }
+
+    // Rewrites a prefix expression bottom up, folding constant subtrees,
+    // applying the identities x + 0, x - 0, x * 1, x / 1, x - x and x * 0,
+    // and gathering the constants of nested additions and multiplications
+    // such as c1 * (c2 * x) into one. The identities which drop a subtree
+    // are only applied when its range, see RangeExpr, shows it finite for
+    // any finite arguments, as an infinite x does not give x - x = 0. The
+    // output is appended to the code and constants given, and the extent
+    // of every output node to the extents, without its depth and offset.
+    class Simplifier
     {
-        if(id == 0)
-            return first;
-        
-        while (first != last)
+    public:
+        std::vector<Instr>& code;
+
+        std::vector<double>& consts;
+
+        std::vector<Extent> extents{};
+
+        Simplifier(std::vector<Instr>& code, std::vector<double>& consts)
+            : code{code}
+            , consts{consts}
+            , base_{code.size()}
         {
-            if(id-- == 0)
-                return first;
-            switch (*first)
+        }
+
+        template<typename ForwardIt, typename ForwardConstIt>
+        ForwardIt Visit(
+            ForwardIt first,
+            ForwardIt last,
+            ForwardConstIt& constIt)
+        {
+            assert(first != last && "Cannot simplify an empty Expr");
+            code.push_back(*first);
+            extents.push_back(Extent{1, first->op == OpCode::LoadConst});
+            if(IsTerminal(first->op))
+            {
+                if(first->op == OpCode::LoadConst)
+                    consts.push_back(*constIt++);
+                return std::next(first);
+            }
+
+            auto const Node = Range{code.size() - 1, consts.size()};
+            auto const RhsEnd = Visit(
+                Visit(std::next(first), last, constIt),
+                last,
+                constIt);
+            ExtentOf(Node.code) = Extent{
+                static_cast<std::uint32_t>(code.size() - Node.code),
+                static_cast<std::uint32_t>(consts.size() - Node.consts)};
+            Reduce(Node);
+            return RhsEnd;
+        }
+
+    private:
+        // A subtree of the output, the code and constants from the starting
+        // offsets up to the next sibling.
+        struct Range
+        {
+            std::size_t code;
+            std::size_t consts;
+        };
+
+        // The first node of the output, the extents start from it.
+        std::size_t const base_;
+
+        Extent& ExtentOf(std::size_t node) noexcept
+        {
+            return extents[node - base_];
+        }
+
+        Extent ExtentOf(std::size_t node) const noexcept
+        {
+            return extents[node - base_];
+        }
+
+        std::vector<Extent>::iterator ExtentIt(std::size_t node) noexcept
+        {
+            return extents.begin() + (node - base_);
+        }
+
+        Range Next(Range r) const noexcept
+        {
+            auto const Extent = ExtentOf(r.code);
+            return {r.code + Extent.size, r.consts + Extent.consts};
+        }
+
+        bool IsConst(Range r, double value) const
+        {
+            return code[r.code].op == OpCode::LoadConst
+                && consts[r.consts] == value;
+        }
+
+        bool IsFinite(Range first, Range last) const
+        {
+            constexpr auto Max = std::numeric_limits<double>::max();
+            auto const Bound = RangeExpr(
+                code.begin() + first.code,
+                code.begin() + last.code,
+                consts.begin() + last.consts,
+                [](std::size_t) noexcept { return Interval{-Max, Max}; });
+            return std::isfinite(Bound.lo) && std::isfinite(Bound.hi);
+        }
+
+        bool Equal(Range a, Range b, Range bEnd) const
+        {
+            auto const A = ExtentOf(a.code);
+            auto const B = ExtentOf(b.code);
+            return A.size == B.size
+                && A.consts == B.consts
+                && std::equal(
+                    code.begin() + a.code,
+                    code.begin() + b.code,
+                    code.begin() + b.code,
+                    code.begin() + bEnd.code)
+                && std::equal(
+                    consts.begin() + a.consts,
+                    consts.begin() + b.consts,
+                    consts.begin() + b.consts,
+                    consts.begin() + bEnd.consts);
+        }
+
+        // Replace the node with the subtree [first, last).
+        void Keep(Range node, Range first, Range last)
+        {
+            code.erase(code.begin() + node.code, code.begin() + first.code);
+            code.resize(node.code + last.code - first.code);
+            extents.erase(ExtentIt(node.code), ExtentIt(first.code));
+            extents.resize(code.size() - base_);
+            consts.erase(
+                consts.begin() + node.consts,
+                consts.begin() + first.consts);
+            consts.resize(node.consts + last.consts - first.consts);
+        }
+
+        // Replace the node with a constant.
+        void Fold(Range node, double value)
+        {
+            code.resize(node.code);
+            code.push_back({OpCode::LoadConst, 0});
+            extents.resize(node.code - base_);
+            extents.push_back(Extent{1, 1});
+            consts.resize(node.consts);
+            consts.push_back(value);
+        }
+
+        void Reduce(Range node)
+        {
+            auto const Op = code[node.code].op;
+            auto const Lhs = Range{node.code + 1, node.consts};
+            auto const Rhs = Next(Lhs);
+            auto const End = Range{code.size(), consts.size()};
+            auto const LhsConst = code[Lhs.code].op == OpCode::LoadConst;
+            auto const RhsConst = code[Rhs.code].op == OpCode::LoadConst;
+
+            if(LhsConst && RhsConst)
+                return Fold(
+                    node,
+                    ApplyOp(Op, consts[Lhs.consts], consts[Rhs.consts]));
+
+            switch (Op)
             {
-            case OpCode::LoadConst:
-            case OpCode::LoadArg:
-                first += 2;
-                break;
             case OpCode::Add:
+                if(IsConst(Lhs, 0.0))
+                    return Keep(node, Rhs, End);
+                if(IsConst(Rhs, 0.0))
+                    return Keep(node, Lhs, Rhs);
+                break;
             case OpCode::Sub:
+                if(IsConst(Rhs, 0.0))
+                    return Keep(node, Lhs, Rhs);
+                if(Equal(Lhs, Rhs, End) && IsFinite(Lhs, Rhs))
+                    return Fold(node, 0.0);
+                break;
             case OpCode::Mul:
-            case OpCode::Div:
-                ++first;
+                if(IsConst(Lhs, 1.0))
+                    return Keep(node, Rhs, End);
+                if(IsConst(Rhs, 1.0))
+                    return Keep(node, Lhs, Rhs);
+                if((IsConst(Lhs, 0.0) && IsFinite(Rhs, End))
+                    || (IsConst(Rhs, 0.0) && IsFinite(Lhs, Rhs)))
+                    return Fold(node, 0.0);
                 break;
+            case OpCode::Div:
+                if(IsConst(Rhs, 1.0))
+                    return Keep(node, Lhs, Rhs);
+                return;
             }
-        }
 
-        return first;
-    }
+            if(LhsConst == RhsConst
+                || (Op != OpCode::Add && Op != OpCode::Mul))
+                return;
+
+            // Reassociate c1 op (c2 op x) and c1 op (x op c2) into
+            // (c1 op c2) op x, with the constant on either side.
+            auto const C = LhsConst ? Lhs : Rhs;
+            auto const Other = LhsConst ? Rhs : Lhs;
+            auto const OtherEnd = LhsConst ? End : Rhs;
+            if(code[Other.code].op != Op)
+                return;
+
+            auto const Inner = Range{Other.code + 1, Other.consts};
+            auto const InnerRhs = Next(Inner);
+            Range rest;
+            Range restEnd;
+            double c2;
+            if(code[Inner.code].op == OpCode::LoadConst)
+            {
+                c2 = consts[Inner.consts];
+                rest = InnerRhs;
+                restEnd = OtherEnd;
+            }
+            else if(code[InnerRhs.code].op == OpCode::LoadConst)
+            {
+                c2 = consts[InnerRhs.consts];
+                rest = Inner;
+                restEnd = InnerRhs;
+            }
+            else
+                return;
+
+            auto const Value = ApplyOp(Op, consts[C.consts], c2);
+            std::vector<Instr> restCode{
+                code.begin() + rest.code,
+                code.begin() + restEnd.code};
+            std::vector<double> restConsts{
+                consts.begin() + rest.consts,
+                consts.begin() + restEnd.consts};
+            std::vector<Extent> restExtents{
+                ExtentIt(rest.code),
+                ExtentIt(restEnd.code)};
+            Fold(node, Value);
+            code.insert(code.begin() + node.code, {Op, 0});
+            code.insert(code.end(), restCode.begin(), restCode.end());
+            consts.insert(consts.end(), restConsts.begin(), restConsts.end());
+            extents.insert(
+                ExtentIt(node.code),
+                Extent{
+                    static_cast<std::uint32_t>(2 + restCode.size()),
+                    static_cast<std::uint32_t>(1 + restConsts.size())});
+            extents.insert(
+                extents.end(),
+                restExtents.begin(),
+                restExtents.end());
+
+            // The folded constant may itself be an identity
+            Reduce(node);
+        }
+    };
 }
 
 
-// Expr encapsulate the prefix notations and provide some basic manipulation.
-class Expr final
+// A read only view of a prefix expression whose code and constants are kept
+// elsewhere, such as by an Expr or in an ExprArena.
+class ExprView final
 {
-    // Functions for composing expressions.
-    friend Expr Const(double constVal);
-    friend Expr Arg(std::uint64_t argId);
-    friend Expr operator+(Expr const& lhs, Expr const& rhs);
-    friend Expr operator-(Expr const& lhs, Expr const& rhs);
-    friend Expr operator*(Expr const& lhs, Expr const& rhs);
-    friend Expr operator/(Expr const& lhs, Expr const& rhs);
 public:
-    // Replace a node in the Expr with another Expr.
-    bool Replace(std::size_t id, Expr const& expr);
+    ExprView() noexcept = default;
+
+    ExprView(
+        internal::Instr const* code,
+        internal::Extent const* extents,
+        std::size_t count,
+        double const* consts,
+        std::size_t constCount)
+        noexcept;
 
     // Evaluate the expression using a range of arguments.
     template<typename RandomIt>
     double Eval(RandomIt argIt) const;
 
+    // Evaluate the expression for rows of column-major arguments, a block
+    // of rows at a time. The columns are stride values apart.
+    void Eval(
+        double const* columns,
+        std::size_t stride,
+        std::size_t rows,
+        double* out) const;
+
     // Print the expression.
     std::ostream& Print(std::ostream& outs) const;
 
     // Count the number of elements in the expression.
     std::size_t Count() const noexcept;
 
-    // Extract a Sub Expr from this Expr starting from a given node.
-    Expr SubExpr(std::size_t id) const;
+    // Count the number of constants in the expression.
+    std::size_t ConstCount() const noexcept;
 
+    // View the sub expression starting from a given node.
+    ExprView SubExpr(std::size_t id) const noexcept;
 
-private:
-    std::vector<std::uint64_t> expr_{};
+    // Bound the values of the expression for arguments within ranges by
+    // interval arithmetic. The bounds hold for any such arguments but may
+    // be far from tight, as every operand is taken to vary on its own. A
+    // range of a single infinity is certain, the expression is infinite for
+    // every such argument.
+    Interval Range(Interval const* args) const;
 
-    template<typename ForwardIt>
-    explicit Expr(ForwardIt first, ForwardIt last)
-        : expr_{first, last}
-    {
-    }
+    // A structural hash, structurally equal expressions hash the same.
+    std::uint64_t Hash() const;
 
-    explicit Expr(double constVal)
-    {
-        expr_.push_back(internal::OpCode::LoadConst);
-        std::uint64_t temp;
-        std::memcpy(&temp, &constVal, 8);
-        expr_.push_back(temp);
-    }
+    // Structural equality.
+    bool operator==(ExprView other) const noexcept;
 
-    explicit Expr(std::uint64_t argId)
-    {
-        expr_.push_back(internal::OpCode::LoadArg);
-        expr_.push_back(argId);
-    }
+    bool operator!=(ExprView other) const noexcept;
 
-    explicit Expr(
-        internal::OpCode op,
-        Expr const& lhs,
-        Expr const& rhs)
-    {
-        expr_.reserve(lhs.expr_.size() + rhs.expr_.size() + 1);
-        expr_.push_back(op);
-        std::copy(
-            lhs.expr_.begin(),
-            lhs.expr_.end(),
-            std::back_inserter(expr_));
-        std::copy(
-            rhs.expr_.begin(),
-            rhs.expr_.end(),
-            std::back_inserter(expr_));
-    }
-};
+    internal::Instr const* BeginCode() const noexcept;
 
-// Members of Expr
-bool Expr::Replace(std::size_t id, Expr const& expr)
+    internal::Instr const* EndCode() const noexcept;
+
+    // The extents of the nodes, parallel to the code.
+    internal::Extent const* BeginExtents() const noexcept;
+
+    double const* BeginConsts() const noexcept;
+
+    double const* EndConsts() const noexcept;
+
+private:
+    internal::Instr const* code_ = nullptr;
+
+    internal::Extent const* extents_ = nullptr;
+
+    std::size_t count_{};
+
+    double const* consts_ = nullptr;
+
+    std::size_t constCount_{};
+};
+
+// Expr encapsulate the prefix notations and provide some basic manipulation.
+// Every node is a single Instr, so the id of a node (its order in a depth
+// first traversal) is also its offset in the code, and the extents of the
+// nodes give the end of any subtree without scanning the code.
+class Expr final
+{
+    // Functions for composing expressions.
+    friend Expr Const(double constVal);
+    friend Expr Arg(std::uint64_t argId);
+    friend Expr operator+(Expr const& lhs, Expr const& rhs);
+    friend Expr operator-(Expr const& lhs, Expr const& rhs);
+    friend Expr operator*(Expr const& lhs, Expr const& rhs);
+    friend Expr operator/(Expr const& lhs, Expr const& rhs);
+public:
+    // Copy the expression seen by a view.
+    explicit Expr(ExprView view);
+
+    // Copy an expression with the sub expression at a node, other than the
+    // root, replaced by another expression.
+    explicit Expr(ExprView expr, std::size_t id, ExprView replacement);
+
+    // Replace a node in the Expr with another Expr.
+    bool Replace(std::size_t id, Expr const& expr);
+
+    // Evaluate the expression using a range of arguments.
+    template<typename RandomIt>
+    double Eval(RandomIt argIt) const;
+
+    // Evaluate the expression for rows of column-major arguments, a block
+    // of rows at a time. The columns are stride values apart.
+    void Eval(
+        double const* columns,
+        std::size_t stride,
+        std::size_t rows,
+        double* out) const;
+
+    // Print the expression.
+    std::ostream& Print(std::ostream& outs) const;
+
+    // Count the number of elements in the expression.
+    std::size_t Count() const noexcept;
+
+    // Extract a Sub Expr from this Expr starting from a given node.
+    Expr SubExpr(std::size_t id) const;
+
+    // Create a simplified copy of the expression with its constant
+    // subtrees folded and redundant nodes removed.
+    Expr Simplify() const;
+
+    // A structural hash, structurally equal expressions hash the same.
+    std::uint64_t Hash() const;
+
+    // Structural equality.
+    bool operator==(Expr const& other) const noexcept;
+
+    bool operator!=(Expr const& other) const noexcept;
+
+    // The bytecode of the expression.
+    std::vector<internal::Instr> const& Code() const noexcept;
+
+    // The constant pool of the expression.
+    std::vector<double> const& Consts() const noexcept;
+
+    // View the expression, the view is invalidated by changing it.
+    operator ExprView() const noexcept;
+
+private:
+    std::vector<internal::Instr> code_{};
+
+    std::vector<internal::Extent> extents_{};
+
+    std::vector<double> consts_{};
+
+    template<typename ForwardIt, typename ForwardConstIt>
+    explicit Expr(
+        ForwardIt first,
+        ForwardIt last,
+        ForwardConstIt constFirst,
+        ForwardConstIt constLast)
+        : code_{first, last}
+        , extents_(code_.size())
+        , consts_{constFirst, constLast}
+    {
+        internal::IndexExpr(code_.begin(), code_.end(), extents_.begin());
+    }
+
+    explicit Expr(double constVal)
+        : code_{{internal::OpCode::LoadConst, 0}}
+        , extents_{{1, 1}}
+        , consts_{constVal}
+    {
+    }
+
+    explicit Expr(std::uint64_t argId)
+        : code_{{
+            internal::OpCode::LoadArg,
+            static_cast<std::uint16_t>(argId)}}
+        , extents_{{1, 0}}
+    {
+        assert(argId <= std::numeric_limits<std::uint16_t>::max()
+            && "Argument id out of range");
+    }
+
+    explicit Expr(
+        internal::OpCode op,
+        Expr const& lhs,
+        Expr const& rhs)
+    {
+        code_.reserve(lhs.code_.size() + rhs.code_.size() + 1);
+        code_.push_back({op, 0});
+        code_.insert(code_.end(), lhs.code_.begin(), lhs.code_.end());
+        code_.insert(code_.end(), rhs.code_.begin(), rhs.code_.end());
+
+        extents_.reserve(code_.size());
+        extents_.push_back({
+            static_cast<std::uint32_t>(code_.size()),
+            static_cast<std::uint32_t>(
+                lhs.consts_.size() + rhs.consts_.size())});
+        extents_.insert(
+            extents_.end(),
+            lhs.extents_.begin(),
+            lhs.extents_.end());
+        extents_.insert(
+            extents_.end(),
+            rhs.extents_.begin(),
+            rhs.extents_.end());
+        internal::PlaceExpr(extents_.begin(), extents_.end());
+
+        consts_.reserve(lhs.consts_.size() + rhs.consts_.size());
+        consts_.insert(consts_.end(), lhs.consts_.begin(), lhs.consts_.end());
+        consts_.insert(consts_.end(), rhs.consts_.begin(), rhs.consts_.end());
+    }
+};
+
+// Writes an expression node by node in prefix order straight into the
+// storage of an ExprArena, see ExprArena::Write.
+class ExprWriter final
+{
+    friend class ExprArena;
+public:
+    void PushConst(double constVal);
+
+    void PushArg(std::uint64_t argId);
+
+    // Push an operator, which must be followed by both of its operands.
+    void PushOp(internal::OpCode op);
+
+    // Push a copy of a whole expression.
+    void Append(ExprView expr);
+
+private:
+    std::vector<internal::Instr>& code_;
+
+    std::vector<double>& consts_;
+
+    ExprWriter(
+        std::vector<internal::Instr>& code,
+        std::vector<double>& consts)
+        noexcept;
+};
+
+// Storage for the expressions of a whole generation. Expressions are written
+// one after another into a single buffer of code and one of constants and
+// are referred to by their slice of both. Clearing the arena keeps its
+// memory, so once it has grown to the size of a generation filling it again
+// does not allocate.
+//
+// Appending may move the buffers, which invalidates the views of the arena,
+// so an arena is never appended to from a view of itself.
+class ExprArena final
+{
+public:
+    // The offsets and lengths of an expression in the buffers.
+    struct Slice
+    {
+        std::size_t code;
+        std::size_t count;
+        std::size_t consts;
+        std::size_t constCount;
+    };
+
+    ExprView View(Slice slice) const noexcept;
+
+    // The constants of an expression, which may be changed in place as
+    // they do not affect the shape of the expression.
+    double* Consts(Slice slice) noexcept;
+
+    // Append a copy of an expression.
+    Slice Append(ExprView expr);
+
+    // Append a copy of an expression with the sub expression at a node
+    // replaced by another expression. Replacing the root copies the
+    // replacement.
+    Slice Splice(ExprView expr, std::size_t id, ExprView replacement);
+
+    // Append a simplified copy of an expression, see Expr::Simplify.
+    Slice AppendSimplified(ExprView expr);
+
+    // Append an expression written by a function called with an
+    // ExprWriter, so a generator does not need a buffer of its own.
+    template<typename F>
+    Slice Write(F&& write);
+
+    // Append a copy of an expression with the sub expression at a node
+    // replaced by one written by a function called with an ExprWriter.
+    template<typename F>
+    Slice SpliceWrite(ExprView expr, std::size_t id, F&& write);
+
+    // Forget all the expressions but keep the memory.
+    void Clear() noexcept;
+
+    // The number of elements of all the expressions.
+    std::size_t Count() const noexcept;
+
+private:
+    Slice Begin() const noexcept;
+
+    Slice End(Slice first) const noexcept;
+
+    std::vector<internal::Instr> code_{};
+
+    std::vector<internal::Extent> extents_{};
+
+    std::vector<double> consts_{};
+};
+
+// Members of ExprView
+ExprView::ExprView(
+    internal::Instr const* code,
+    internal::Extent const* extents,
+    std::size_t count,
+    double const* consts,
+    std::size_t constCount)
+    noexcept
+    : code_{code}
+    , extents_{extents}
+    , count_{count}
+    , consts_{consts}
+    , constCount_{constCount}
+{
+}
+
+template<typename RandomIt>
+double ExprView::Eval(RandomIt argIt) const
+{
+    std::vector<double> stack(internal::StackDepthExpr(BeginCode(), EndCode()));
+    return internal::EvalExpr(
+        BeginCode(),
+        EndCode(),
+        EndConsts(),
+        argIt,
+        stack.data());
+}
+
+void ExprView::Eval(
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows,
+    double* out) const
+{
+    auto const Depth = internal::StackDepthExpr(BeginCode(), EndCode());
+    std::vector<double> stack(Depth * internal::EvalBlockSize);
+    for(std::size_t row{}; row < rows; row += internal::EvalBlockSize)
+        internal::EvalExprBlock(
+            BeginCode(),
+            EndCode(),
+            EndConsts(),
+            columns,
+            stride,
+            row,
+            std::min(internal::EvalBlockSize, rows - row),
+            out + row,
+            stack.data());
+}
+
+std::ostream& ExprView::Print(std::ostream& outs) const
+{
+    auto constIt = BeginConsts();
+    internal::PrintExpr(BeginCode(), EndCode(), constIt, outs);
+    return outs;
+}
+
+std::size_t ExprView::Count() const noexcept
+{
+    return count_;
+}
+
+std::size_t ExprView::ConstCount() const noexcept
+{
+    return constCount_;
+}
+
+Interval ExprView::Range(Interval const* args) const
+{
+    return internal::RangeExpr(
+        BeginCode(),
+        EndCode(),
+        EndConsts(),
+        [args](std::size_t arg) noexcept { return args[arg]; });
+}
+
+ExprView ExprView::SubExpr(std::size_t id) const noexcept
+{
+    if(count_ <= id)
+        return ExprView{EndCode(), extents_ + count_, 0, EndConsts(), 0};
+
+    auto const Extent = extents_[id];
+    return ExprView{
+        code_ + id,
+        extents_ + id,
+        Extent.size,
+        consts_ + (Extent.constOffset - extents_->constOffset),
+        Extent.consts};
+}
+
+std::uint64_t ExprView::Hash() const
+{
+    // Every thread hashes with a stack of its own, so that hashing an
+    // offspring does not allocate
+    thread_local std::vector<std::uint64_t> stack{};
+    return internal::HashExpr(BeginCode(), EndCode(), EndConsts(), stack);
+}
+
+bool ExprView::operator==(ExprView other) const noexcept
+{
+    return std::equal(
+            BeginCode(),
+            EndCode(),
+            other.BeginCode(),
+            other.EndCode())
+        && std::equal(
+            BeginConsts(),
+            EndConsts(),
+            other.BeginConsts(),
+            other.EndConsts());
+}
+
+bool ExprView::operator!=(ExprView other) const noexcept
+{
+    return !(*this == other);
+}
+
+internal::Instr const* ExprView::BeginCode() const noexcept
+{
+    return code_;
+}
+
+internal::Instr const* ExprView::EndCode() const noexcept
+{
+    return code_ + count_;
+}
+
+internal::Extent const* ExprView::BeginExtents() const noexcept
+{
+    return extents_;
+}
+
+double const* ExprView::BeginConsts() const noexcept
+{
+    return consts_;
+}
+
+double const* ExprView::EndConsts() const noexcept
+{
+    return consts_ + constCount_;
+}
+
+std::ostream& operator<<(std::ostream& outs, ExprView expr)
+{
+    return expr.Print(outs);
+}
+
+// Members of Expr
+Expr::Expr(ExprView view)
+    : code_{view.BeginCode(), view.EndCode()}
+    , extents_{view.BeginExtents(), view.BeginExtents() + view.Count()}
+    , consts_{view.BeginConsts(), view.EndConsts()}
+{
+}
+
+Expr::Expr(ExprView expr, std::size_t id, ExprView replacement)
 {
-    auto i = internal::FindExpr(expr_.begin(), expr_.end(), id);
-    if(i == expr_.begin())
+    assert(0 < id && id < expr.Count() && "Out of bounds node");
+    auto const Sub = expr.SubExpr(id);
+    auto const Count = expr.Count() - Sub.Count() + replacement.Count();
+    auto const ConstCount = expr.ConstCount() - Sub.ConstCount()
+        + replacement.ConstCount();
+    auto const* Extents = expr.BeginExtents();
+    auto const* SubExtents = Sub.BeginExtents();
+
+    code_.reserve(Count);
+    code_.insert(code_.end(), expr.BeginCode(), Sub.BeginCode());
+    code_.insert(
+        code_.end(),
+        replacement.BeginCode(),
+        replacement.EndCode());
+    code_.insert(code_.end(), Sub.EndCode(), expr.EndCode());
+
+    extents_.reserve(Count);
+    extents_.insert(extents_.end(), Extents, SubExtents);
+    extents_.insert(
+        extents_.end(),
+        replacement.BeginExtents(),
+        replacement.BeginExtents() + replacement.Count());
+    extents_.insert(
+        extents_.end(),
+        SubExtents + Sub.Count(),
+        Extents + expr.Count());
+    internal::DescendExpr(
+        extents_.data(),
+        id,
+        [&](auto node)
+        {
+            extents_[node].size = static_cast<std::uint32_t>(
+                extents_[node].size - Sub.Count() + replacement.Count());
+            extents_[node].consts = static_cast<std::uint32_t>(
+                extents_[node].consts - Sub.ConstCount()
+                    + replacement.ConstCount());
+        });
+    internal::PlaceExpr(extents_.begin(), extents_.end());
+
+    consts_.reserve(ConstCount);
+    consts_.insert(consts_.end(), expr.BeginConsts(), Sub.BeginConsts());
+    consts_.insert(
+        consts_.end(),
+        replacement.BeginConsts(),
+        replacement.EndConsts());
+    consts_.insert(consts_.end(), Sub.EndConsts(), expr.EndConsts());
+}
+
+bool Expr::Replace(std::size_t id, Expr const& expr)
+{
+    assert(id < code_.size() && "Out of bounds node");
+    if(id == 0)
         return false;
-    i = expr_.erase(i, internal::EndOfExpr(i, expr_.end()));
-    std::copy(
-        expr.expr_.cbegin(),
-        expr.expr_.cend(),
-        std::inserter(expr_, i));
+
+    *this = Expr{*this, id, expr};
     return true;
 }
 
 template<typename RandomIt>
 double Expr::Eval(RandomIt argIt) const
 {
-    auto [val, it] = internal::EvalExpr(expr_.begin(), expr_.end(), argIt);
-    if(it != expr_.end())
-        return 0.0;
-    return val;
+    return ExprView{*this}.Eval(argIt);
+}
+
+void Expr::Eval(
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows,
+    double* out) const
+{
+    ExprView{*this}.Eval(columns, stride, rows, out);
 }
 
 Expr Expr::SubExpr(std::size_t id) const
 {
-    auto i = internal::FindExpr(expr_.begin(), expr_.end(), id);
-    return Expr{
-        i,
-        i != expr_.end()
-            ? internal::EndOfExpr(i, expr_.end())
-            : expr_.end()};
+    return Expr{ExprView{*this}.SubExpr(id)};
+}
+
+Expr Expr::Simplify() const
+{
+    if(code_.empty())
+        return *this;
+
+    std::vector<internal::Instr> code{};
+    std::vector<double> consts{};
+    auto constIt = consts_.begin();
+    internal::Simplifier{code, consts}.Visit(
+        code_.begin(),
+        code_.end(),
+        constIt);
+    return Expr{code.begin(), code.end(), consts.begin(), consts.end()};
+}
+
+std::uint64_t Expr::Hash() const
+{
+    return ExprView{*this}.Hash();
+}
+
+bool Expr::operator==(Expr const& other) const noexcept
+{
+    return code_ == other.code_ && consts_ == other.consts_;
+}
+
+bool Expr::operator!=(Expr const& other) const noexcept
+{
+    return !(*this == other);
 }
 
 std::size_t Expr::Count() const noexcept
 {
-    return internal::CountExpr(expr_.begin(), expr_.end());
+    return code_.size();
+}
+
+std::vector<internal::Instr> const& Expr::Code() const noexcept
+{
+    return code_;
+}
+
+std::vector<double> const& Expr::Consts() const noexcept
+{
+    return consts_;
+}
+
+Expr::operator ExprView() const noexcept
+{
+    return ExprView{
+        code_.data(),
+        extents_.data(),
+        code_.size(),
+        consts_.data(),
+        consts_.size()};
 }
 
 std::ostream& Expr::Print(std::ostream& outs) const
 {
-    internal::PrintExpr(expr_.begin(), expr_.end(), outs);
-    return outs;
+    return ExprView{*this}.Print(outs);
+}
+
+// Members of ExprWriter
+ExprWriter::ExprWriter(
+    std::vector<internal::Instr>& code,
+    std::vector<double>& consts)
+    noexcept
+    : code_{code}
+    , consts_{consts}
+{
+}
+
+void ExprWriter::PushConst(double constVal)
+{
+    code_.push_back({internal::OpCode::LoadConst, 0});
+    consts_.push_back(constVal);
+}
+
+void ExprWriter::PushArg(std::uint64_t argId)
+{
+    assert(argId <= std::numeric_limits<std::uint16_t>::max()
+        && "Argument id out of range");
+    code_.push_back({
+        internal::OpCode::LoadArg,
+        static_cast<std::uint16_t>(argId)});
+}
+
+void ExprWriter::PushOp(internal::OpCode op)
+{
+    assert(!internal::IsTerminal(op) && "Not an operator");
+    code_.push_back({op, 0});
+}
+
+void ExprWriter::Append(ExprView expr)
+{
+    code_.insert(code_.end(), expr.BeginCode(), expr.EndCode());
+    consts_.insert(consts_.end(), expr.BeginConsts(), expr.EndConsts());
+}
+
+// Members of ExprArena
+ExprView ExprArena::View(Slice slice) const noexcept
+{
+    assert(slice.code + slice.count <= code_.size()
+        && slice.consts + slice.constCount <= consts_.size()
+        && "Slice out of the arena");
+    return ExprView{
+        code_.data() + slice.code,
+        extents_.data() + slice.code,
+        slice.count,
+        consts_.data() + slice.consts,
+        slice.constCount};
+}
+
+double* ExprArena::Consts(Slice slice) noexcept
+{
+    assert(slice.consts + slice.constCount <= consts_.size()
+        && "Slice out of the arena");
+    return consts_.data() + slice.consts;
+}
+
+ExprArena::Slice ExprArena::Append(ExprView expr)
+{
+    auto const First = Begin();
+    code_.insert(code_.end(), expr.BeginCode(), expr.EndCode());
+    extents_.insert(
+        extents_.end(),
+        expr.BeginExtents(),
+        expr.BeginExtents() + expr.Count());
+    consts_.insert(consts_.end(), expr.BeginConsts(), expr.EndConsts());
+    return End(First);
+}
+
+ExprArena::Slice ExprArena::Splice(
+    ExprView expr,
+    std::size_t id,
+    ExprView replacement)
+{
+    return SpliceWrite(
+        expr,
+        id,
+        [&](ExprWriter& out) { out.Append(replacement); });
+}
+
+template<typename F>
+ExprArena::Slice ExprArena::Write(F&& write)
+{
+    auto const First = Begin();
+    ExprWriter out{code_, consts_};
+    write(out);
+    extents_.resize(code_.size());
+    internal::IndexExpr(
+        code_.begin() + First.code,
+        code_.end(),
+        extents_.begin() + First.code);
+    return End(First);
 }
+
+template<typename F>
+ExprArena::Slice ExprArena::SpliceWrite(
+    ExprView expr,
+    std::size_t id,
+    F&& write)
+{
+    assert(id < expr.Count() && "Out of bounds node");
+    if(id == 0)
+        return Write(std::forward<F>(write));
+
+    auto const First = Begin();
+    auto const Sub = expr.SubExpr(id);
+    auto const* Extents = expr.BeginExtents();
+    auto const* SubExtents = Sub.BeginExtents();
+    code_.insert(code_.end(), expr.BeginCode(), Sub.BeginCode());
+    extents_.insert(extents_.end(), Extents, SubExtents);
+    consts_.insert(consts_.end(), expr.BeginConsts(), Sub.BeginConsts());
+
+    auto const Replacement = Write(std::forward<F>(write));
+
+    code_.insert(code_.end(), Sub.EndCode(), expr.EndCode());
+    extents_.insert(
+        extents_.end(),
+        SubExtents + Sub.Count(),
+        Extents + expr.Count());
+    consts_.insert(consts_.end(), Sub.EndConsts(), expr.EndConsts());
+
+    // The ancestors of the node change size with it
+    internal::DescendExpr(
+        extents_.data() + First.code,
+        id,
+        [&](auto node)
+        {
+            auto& extent = extents_[First.code + node];
+            extent.size = static_cast<std::uint32_t>(
+                extent.size - Sub.Count() + Replacement.count);
+            extent.consts = static_cast<std::uint32_t>(
+                extent.consts - Sub.ConstCount() + Replacement.constCount);
+        });
+    internal::PlaceExpr(extents_.begin() + First.code, extents_.end());
+    return End(First);
+}
+
+ExprArena::Slice ExprArena::AppendSimplified(ExprView expr)
+{
+    auto const First = Begin();
+    if(expr.Count() == 0)
+        return First;
+
+    auto constIt = expr.BeginConsts();
+    internal::Simplifier simplifier{code_, consts_};
+    simplifier.Visit(expr.BeginCode(), expr.EndCode(), constIt);
+    internal::PlaceExpr(simplifier.extents.begin(), simplifier.extents.end());
+    extents_.insert(
+        extents_.end(),
+        simplifier.extents.begin(),
+        simplifier.extents.end());
+    return End(First);
+}
+
+void ExprArena::Clear() noexcept
+{
+    code_.clear();
+    extents_.clear();
+    consts_.clear();
+}
+
+std::size_t ExprArena::Count() const noexcept
+{
+    return code_.size();
+}
+
+ExprArena::Slice ExprArena::Begin() const noexcept
+{
+    return {code_.size(), 0, consts_.size(), 0};
+}
+
+ExprArena::Slice ExprArena::End(Slice first) const noexcept
+{
+    return {
+        first.code,
+        code_.size() - first.code,
+        first.consts,
+        consts_.size() - first.consts};
+}
+
 // Friends of Expr
 Expr Const(double constVal)
 {
@@ -401,6 +1647,131 @@ ForwardIt Roulette(ForwardIt first, ForwardIt last, RngT& rng, F&& f)
     return last;
 }
 
+// Samples indices in proportion to their weights in constant time, after
+// building a table in time linear in the number of weights (Vose's alias
+// method). Sampling does not change the table, so several threads may
+// sample it at once, and rebuilding the table reuses its memory. When the
+// weights do not have a finite positive total every index is as likely.
+class AliasTable final
+{
+public:
+    template<typename ForwardIt, typename F>
+    void Build(ForwardIt first, ForwardIt last, F&& weight);
+
+    template<typename RngT>
+    std::size_t Sample(RngT& rng) const;
+
+    std::size_t Size() const noexcept;
+
+private:
+    std::vector<double> propability_{};
+
+    std::vector<std::size_t> alias_{};
+
+    std::vector<std::size_t> small_{};
+
+    std::vector<std::size_t> large_{};
+};
+
+template<typename ForwardIt, typename F>
+void AliasTable::Build(ForwardIt first, ForwardIt last, F&& weight)
+{
+    propability_.clear();
+    std::transform(first, last, std::back_inserter(propability_), weight);
+    auto const Count = propability_.size();
+    auto const Total = std::accumulate(
+        propability_.cbegin(),
+        propability_.cend(),
+        0.0);
+    auto const Uniform = !(0.0 < Total && std::isfinite(Total));
+
+    // Scale the weights to an average of one and split them by whether
+    // they fill their own column of the table
+    alias_.resize(Count);
+    small_.clear();
+    large_.clear();
+    for(std::size_t i{}; i != Count; ++i)
+    {
+        propability_[i] = Uniform ? 1.0 : propability_[i] * Count / Total;
+        alias_[i] = i;
+        (propability_[i] < 1.0 ? small_ : large_).push_back(i);
+    }
+
+    // Fill the rest of each small column with a part of a large one
+    while(!small_.empty() && !large_.empty())
+    {
+        auto const Small = small_.back();
+        auto const Large = large_.back();
+        small_.pop_back();
+        alias_[Small] = Large;
+        propability_[Large] -= 1.0 - propability_[Small];
+        if(propability_[Large] < 1.0)
+        {
+            large_.pop_back();
+            small_.push_back(Large);
+        }
+    }
+
+    // What is left over is only short of one by rounding
+    for(auto i: small_)
+        propability_[i] = 1.0;
+    for(auto i: large_)
+        propability_[i] = 1.0;
+}
+
+template<typename RngT>
+std::size_t AliasTable::Sample(RngT& rng) const
+{
+    assert(!propability_.empty() && "Cannot sample an empty table");
+    auto const I = std::uniform_int_distribution<std::size_t>{
+        0,
+        propability_.size() - 1}(rng);
+    return std::uniform_real_distribution<>{ 0.0, 1.0 }(rng) < propability_[I]
+        ? I
+        : alias_[I];
+}
+
+std::size_t AliasTable::Size() const noexcept
+{
+    return propability_.size();
+}
+
+// Pick the best of k distinct elements drawn at random without reordering
+// the range, as the best of a SampleGroup of k would be. The elements to
+// skip are never drawn. Takes time in the square of k, not the size of the
+// range.
+template<typename RandomIt, typename RngT, typename Compare>
+RandomIt Tournament(
+    RandomIt first,
+    RandomIt last,
+    std::size_t k,
+    RngT& rng,
+    Compare compare,
+    std::initializer_list<RandomIt> skip = {})
+{
+    assert(k != 0 && "Cannot hold a tournament of size 0");
+
+    auto const Count = static_cast<std::size_t>(std::distance(first, last));
+    std::vector<RandomIt> drawn{skip};
+    assert(drawn.size() < Count && "Cannot hold a tournament of no one");
+    k = std::min(k, Count - drawn.size());
+
+    std::uniform_int_distribution<std::size_t> distribution{0, Count - 1};
+    auto best = last;
+    for(auto const Skipped = drawn.size(); drawn.size() != Skipped + k;)
+    {
+        auto const It = first + distribution(rng);
+        if(std::find(drawn.cbegin(), drawn.cend(), It) != drawn.cend())
+            continue;
+
+        drawn.push_back(It);
+        if(best == last || compare(*It, *best))
+            best = It;
+    }
+
+    return best;
+}
+
 template<typename RandomIt, typename RngT>
 RandomIt SampleGroup(RandomIt first, RandomIt last, std::size_t k, RngT& rng)
 {
@@ -425,34 +1796,152 @@ RandomIt SampleGroup(RandomIt first, RandomIt last, std::size_t k, RngT& rng)
     return first + k;
 }
 
+// Pick a node of an expression by first picking a depth at random and then
+// a node at that depth, so that the many nodes near the leaves are not picked
+// over and over. The root is only picked from an expression which is a
+// single terminal, which simplification may produce.
+template<typename RngT>
+std::size_t DepthFairNode(ExprView expr, RngT& rng)
+{
+    auto const Count = expr.Count();
+    if(Count == 1)
+        return 0;
+
+    // The depths are indexed, relative to the root of the expression
+    auto const Extents = expr.BeginExtents();
+    auto const DepthOf = [&](std::size_t i)
+    {
+        return std::size_t{Extents[i].depth - Extents->depth};
+    };
+
+    std::size_t maxDepth{};
+    std::size_t atDepth{};
+    for(std::size_t i{}; i != Count; ++i)
+        maxDepth = std::max(maxDepth, DepthOf(i));
+    auto const Depth = std::uniform_int_distribution<std::size_t>{
+        1,
+        maxDepth}(rng);
+    for(std::size_t i{}; i != Count; ++i)
+        atDepth += DepthOf(i) == Depth;
+    auto nth = std::uniform_int_distribution<std::size_t>{
+        0,
+        atDepth - 1}(rng);
+    for(std::size_t i{1};; ++i)
+        if(DepthOf(i) == Depth && nth-- == 0)
+            return i;
+}
+
+// Pick a node of an expression whose subtree has from minSize to maxSize
+// nodes, each as likely, the root only from a single terminal as above.
+// Returns Count() when there is no such node.
+template<typename RngT>
+std::size_t SizeFairNode(
+    ExprView expr,
+    std::size_t minSize,
+    std::size_t maxSize,
+    RngT& rng)
+{
+    auto const Count = expr.Count();
+    auto const Extents = expr.BeginExtents();
+    auto const First = Count == 1 ? 0 : 1;
+    auto const Fits = [&](std::size_t i) noexcept
+    {
+        return minSize <= Extents[i].size && Extents[i].size <= maxSize;
+    };
+
+    std::size_t fitting{};
+    for(std::size_t i = First; i != Count; ++i)
+        fitting += Fits(i);
+    if(fitting == 0)
+        return Count;
+
+    auto nth = std::uniform_int_distribution<std::size_t>{
+        0,
+        fitting - 1}(rng);
+    for(std::size_t i = First;; ++i)
+        if(Fits(i) && nth-- == 0)
+            return i;
+}
+
+// The depth of the deepest full tree with at most size nodes.
+constexpr std::size_t FullDepthWithin(std::size_t size) noexcept
+{
+    assert(size != 0 && "No tree has no nodes");
+    std::size_t depth{};
+    while(std::size_t{4} << depth <= size + 1)
+        ++depth;
+    return depth;
+}
+
+// The nodes swapped by a size-fair subtree crossover. The node of a is
+// picked depth-fair and the node of b among the subtrees of at most one more
+// than twice its size, so that the children stay about the size of their
+// parents, and neither child has more than maxSize nodes. Returns Count() of
+// each when there is no such pair.
+template<typename RngT>
+std::pair<std::size_t, std::size_t> CrossoverNodes(
+    ExprView a,
+    ExprView b,
+    std::size_t maxSize,
+    RngT& rng)
+{
+    assert(a.Count() <= maxSize && b.Count() <= maxSize
+        && "The parents of a crossover are too large");
+    auto const IdA = DepthFairNode(a, rng);
+    auto const SizeA = std::size_t{a.BeginExtents()[IdA].size};
+
+    // Child a is a without the subtree plus the subtree of b and child b
+    // the other way round
+    auto const MinSizeB = maxSize < b.Count() + SizeA
+        ? b.Count() + SizeA - maxSize
+        : 1;
+    auto const MaxSizeB = std::min(
+        2 * SizeA + 1,
+        maxSize - (a.Count() - SizeA));
+    auto const IdB = SizeFairNode(b, MinSizeB, MaxSizeB, rng);
+    if(IdB == b.Count())
+        return {a.Count(), b.Count()};
+    return {IdA, IdB};
+}
+
+// Size-fair subtree crossover, see CrossoverNodes. When there is no fair
+// pair of subtrees the children are copies of the parents.
 template<typename RngT>
 std::pair<Expr, Expr> SubtreeCrossover(
     Expr const& a,
     Expr const& b,
+    std::size_t maxSize,
+    RngT& rng)
+{
+    auto const [IdA, IdB] = CrossoverNodes(a, b, maxSize, rng);
+    if(IdA == a.Count())
+        return {a, b};
+
+    // Each child is copied once from its parent and the other sub-tree
+    auto const SubExprA = ExprView{a}.SubExpr(IdA);
+    auto const SubExprB = ExprView{b}.SubExpr(IdB);
+    auto childA = IdA == 0 ? Expr{SubExprB} : Expr{a, IdA, SubExprB};
+    auto childB = IdB == 0 ? Expr{SubExprA} : Expr{b, IdB, SubExprA};
+    return {std::move(childA), std::move(childB)};
+}
+
+// Subtree crossover writing the children straight into an arena, which must
+// not be the arena of the parents.
+template<typename RngT>
+std::pair<ExprArena::Slice, ExprArena::Slice> SubtreeCrossover(
+    ExprView a,
+    ExprView b,
+    std::size_t maxSize,
+    ExprArena& arena,
     RngT& rng)
 {
-    using Distribution = std::uniform_int_distribution<std::size_t>;
-    auto const IdA = Distribution{1, a.Count() - 1}(rng);
-    auto subExprA = a.SubExpr(IdA);
-
-    auto idB = Distribution{ 1, b.Count() - 1 }(rng);
-    auto subExprB = b.SubExpr(idB);
-
-    // If one of the sub-trees is much larger than the other, then keep
-    // selecting sub-trees from one of the sub-trees so that the sizes may
-    // match.
-    //while(subExprA.Count() + 1 < subExprB.Count())
-    //{
-    //    auto const SubIdB = Distribution{ 1, subExprB.Count() - 1 }(rng);
-    //    subExprB = subExprB.SubExpr(SubIdB);
-    //    idB += SubIdB;
-    //}
-
-    auto childA{ a };
-    childA.Replace(IdA, subExprB);
-    auto childB{ b };
-    childB.Replace(idB, a.SubExpr(IdA));
-    return {childA, childB};
+    auto const [IdA, IdB] = CrossoverNodes(a, b, maxSize, rng);
+    if(IdA == a.Count())
+        return {arena.Append(a), arena.Append(b)};
+
+    auto const ChildA = arena.Splice(a, IdA, b.SubExpr(IdB));
+    auto const ChildB = arena.Splice(b, IdB, a.SubExpr(IdA));
+    return {ChildA, ChildB};
 }
 
 #endif // !CS3910__GP_H_
\ No newline at end of file
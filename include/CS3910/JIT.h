@@ -0,0 +1,415 @@
+#ifndef CS3910__JIT_H_
+#define CS3910__JIT_H_
+
+#include "GP.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// The compiler emits SSE2 code for the System V calling convention, other
+// platforms always use the interpreter.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CS3910_JIT 1
+#include <sys/mman.h>
+#else
+#define CS3910_JIT 0
+#endif
+
+namespace internal
+{
+    // Compiled code has the signature
+    // void(columns, consts, out, pairs, stride)
+    // and evaluates two rows at a time. The argument columns are stride
+    // bytes apart from the first, the constants are duplicated to fill a
+    // register with the first being infinity, used by the protected
+    // division. The code keeps the pointers to the columns and the spilled
+    // stack in a frame of its own, so it needs no memory from the caller.
+    using CompiledFn = void(*)(
+        double const* columns,
+        double const* consts,
+        double* out,
+        std::size_t pairs,
+        std::size_t stride);
+
+    // The largest frame of compiled code, deeper expressions are left to the
+    // interpreter.
+    constexpr std::size_t MaxCompiledFrame = std::size_t{1} << 16;
+
+    // Emit x86-64 machine code for a prefix expression. The top of the value
+    // stack is kept in xmm0 and the rest of the stack is spilled to the
+    // frame, the code is generated from the back of the expression in the
+    // same order as EvalExpr runs it. The frame holds stackDepth slots and
+    // then the pointers to the argCount columns.
+    class Assembler
+    {
+    public:
+        std::vector<std::uint8_t> Compile(
+            std::vector<Instr> const& code,
+            std::size_t constCount,
+            std::size_t argCount,
+            std::size_t stackDepth)
+        {
+            code_.clear();
+
+            auto const ColumnsAt = Slot(stackDepth);
+            auto const Frame = static_cast<std::int32_t>(
+                (ColumnsAt + 8 * argCount + 15) / 16 * 16);
+            Emit({0x48, 0x81, 0xEC});               // sub rsp, frame
+            Emit32(Frame);
+            for(std::size_t j{}; j != argCount; ++j)
+            {
+                Emit({0x49, 0x69, 0xC0});           // imul rax, r8, j
+                Emit32(static_cast<std::int32_t>(j));
+                Emit({
+                    0x48, 0x01, 0xF8,               // add rax, rdi
+                    0x48, 0x89, 0x84, 0x24});       // mov [rsp + disp], rax
+                Emit32(static_cast<std::int32_t>(ColumnsAt + 8 * j));
+            }
+            Emit({0x49, 0x89, 0xE0});               // mov r8, rsp
+
+            // xor r9d, r9d; test rcx, rcx; jz end
+            Emit({0x45, 0x31, 0xC9, 0x48, 0x85, 0xC9, 0x0F, 0x84});
+            auto const ExitJump = code_.size();
+            Emit32(0);
+
+            auto const Loop = code_.size();
+            std::size_t depth{};
+            auto constIndex = constCount;
+            for(auto i = code.rbegin(); i != code.rend(); ++i)
+            {
+                if(IsTerminal(i->op))
+                {
+                    if(depth != 0)
+                    {
+                        // movupd [r8 + disp32], xmm0
+                        Emit({0x66, 0x41, 0x0F, 0x11, 0x80});
+                        Emit32(Slot(depth - 1));
+                    }
+
+                    if(i->op == OpCode::LoadArg)
+                    {
+                        // mov rax, [r8 + disp32]
+                        Emit({0x49, 0x8B, 0x80});
+                        Emit32(static_cast<std::int32_t>(
+                            ColumnsAt + 8 * i->arg));
+                        // movupd xmm0, [rax + r9]
+                        Emit({0x66, 0x42, 0x0F, 0x10, 0x04, 0x08});
+                    }
+                    else
+                        LoadConst(0, --constIndex + 1);
+                    ++depth;
+                    continue;
+                }
+
+                // movupd xmm1, [r8 + disp32]
+                Emit({0x66, 0x41, 0x0F, 0x10, 0x88});
+                Emit32(Slot(depth - 2));
+                switch (i->op)
+                {
+                case OpCode::Add:
+                    Emit({0x66, 0x0F, 0x58, 0xC1}); // addpd xmm0, xmm1
+                    break;
+                case OpCode::Sub:
+                    Emit({0x66, 0x0F, 0x5C, 0xC1}); // subpd xmm0, xmm1
+                    break;
+                case OpCode::Mul:
+                    Emit({0x66, 0x0F, 0x59, 0xC1}); // mulpd xmm0, xmm1
+                    break;
+                case OpCode::Div:
+                    // Protected division, select infinity where rhs == 0
+                    Emit({
+                        0x66, 0x0F, 0x57, 0xD2,       // xorpd xmm2, xmm2
+                        0x66, 0x0F, 0xC2, 0xD1, 0x00, // cmpeqpd xmm2, xmm1
+                        0x66, 0x0F, 0x5E, 0xC1,       // divpd xmm0, xmm1
+                        0x66, 0x0F, 0x28, 0xDA,       // movapd xmm3, xmm2
+                        0x66, 0x0F, 0x55, 0xD8});     // andnpd xmm3, xmm0
+                    LoadConst(1, 0);
+                    Emit({
+                        0x66, 0x0F, 0x54, 0xD1,       // andpd xmm2, xmm1
+                        0x66, 0x0F, 0x56, 0xDA,       // orpd xmm3, xmm2
+                        0x66, 0x0F, 0x28, 0xC3});     // movapd xmm0, xmm3
+                    break;
+                }
+                --depth;
+            }
+
+            Emit({
+                0x66, 0x42, 0x0F, 0x11, 0x04, 0x0A, // movupd [rdx + r9], xmm0
+                0x49, 0x83, 0xC1, 0x10,             // add r9, 16
+                0x48, 0xFF, 0xC9,                   // dec rcx
+                0x0F, 0x85});                       // jnz loop
+            Emit32(static_cast<std::int32_t>(Loop - (code_.size() + 4)));
+            Patch32(
+                ExitJump,
+                static_cast<std::int32_t>(code_.size() - (ExitJump + 4)));
+            Emit({0x48, 0x81, 0xC4});               // add rsp, frame
+            Emit32(Frame);
+            Emit({0xC3});                           // ret
+            return std::move(code_);
+        }
+
+    private:
+        std::vector<std::uint8_t> code_{};
+
+        static std::int32_t Slot(std::size_t i) noexcept
+        {
+            return static_cast<std::int32_t>(16 * i);
+        }
+
+        // movupd xmmN, [rsi + disp32]
+        void LoadConst(std::uint8_t reg, std::size_t index)
+        {
+            Emit({0x66, 0x0F, 0x10, static_cast<std::uint8_t>(
+                0x86 | reg << 3)});
+            Emit32(Slot(index));
+        }
+
+        void Emit(std::initializer_list<std::uint8_t> bytes)
+        {
+            code_.insert(code_.end(), bytes.begin(), bytes.end());
+        }
+
+        void Emit32(std::int32_t x)
+        {
+            code_.resize(code_.size() + 4);
+            Patch32(code_.size() - 4, x);
+        }
+
+        void Patch32(std::size_t at, std::int32_t x)
+        {
+            std::memcpy(code_.data() + at, &x, 4);
+        }
+    };
+}
+
+// An Expr compiled to native code once so that it can be evaluated over many
+// rows without paying for the dispatch of the interpreter. Falls back to the
+// interpreter where the compiler is not available.
+class CompiledExpr final
+{
+public:
+    constexpr static bool Available = CS3910_JIT != 0;
+
+    explicit CompiledExpr(Expr expr);
+
+    CompiledExpr(CompiledExpr const&) = delete;
+
+    CompiledExpr(CompiledExpr&& other) noexcept;
+
+    CompiledExpr& operator=(CompiledExpr const&) = delete;
+
+    CompiledExpr& operator=(CompiledExpr&& other) noexcept;
+
+    ~CompiledExpr();
+
+    // Evaluate the expression for rows of column-major arguments, the
+    // columns are stride values apart. Safe to call from several threads at
+    // once.
+    void Eval(
+        double const* columns,
+        std::size_t stride,
+        std::size_t rows,
+        double* out) const;
+
+    // Evaluate the expression with other constants, as many as its own and
+    // in the same order, without compiling it again.
+    void Eval(
+        double const* columns,
+        std::size_t stride,
+        std::size_t rows,
+        double* out,
+        double const* consts) const;
+
+    Expr const& Function() const noexcept;
+
+private:
+    Expr expr_;
+
+    std::vector<double> consts_{};
+
+    std::size_t argCount_{};
+
+    std::size_t stackDepth_{};
+
+    void* page_ = nullptr;
+
+    std::size_t pageSize_{};
+
+    void Release() noexcept;
+
+    // Run the native code with a duplicated constant pool, see CompiledFn,
+    // and the interpreter over the same constants for the odd row out.
+    void Run(
+        double const* columns,
+        std::size_t stride,
+        std::size_t rows,
+        double* out,
+        double const* pool,
+        ExprView expr) const;
+};
+
+CompiledExpr::CompiledExpr(Expr expr)
+    : expr_{std::move(expr)}
+{
+#if CS3910_JIT
+    auto const& Code = expr_.Code();
+    if(Code.empty())
+        return;
+
+    consts_.assign(2, std::numeric_limits<double>::infinity());
+    for(auto c: expr_.Consts())
+        consts_.insert(consts_.end(), 2, c);
+    for(auto&& instr: Code)
+        if(instr.op == internal::OpCode::LoadArg)
+            argCount_ = std::max<std::size_t>(argCount_, instr.arg + 1u);
+    stackDepth_ = internal::StackDepthExpr(Code.begin(), Code.end());
+    if(internal::MaxCompiledFrame < 16 * stackDepth_ + 8 * argCount_)
+        return;
+
+    auto const Machine = internal::Assembler{}.Compile(
+        Code,
+        expr_.Consts().size(),
+        argCount_,
+        stackDepth_);
+    pageSize_ = Machine.size();
+    auto page = mmap(
+        nullptr,
+        pageSize_,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    if(page == MAP_FAILED)
+        return;
+
+    std::memcpy(page, Machine.data(), Machine.size());
+    if(mprotect(page, pageSize_, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(page, pageSize_);
+        return;
+    }
+    page_ = page;
+#endif
+}
+
+CompiledExpr::CompiledExpr(CompiledExpr&& other) noexcept
+    : expr_{std::move(other.expr_)}
+    , consts_{std::move(other.consts_)}
+    , argCount_{other.argCount_}
+    , stackDepth_{other.stackDepth_}
+    , page_{std::exchange(other.page_, nullptr)}
+    , pageSize_{other.pageSize_}
+{
+}
+
+CompiledExpr& CompiledExpr::operator=(CompiledExpr&& other) noexcept
+{
+    if(this != &other)
+    {
+        Release();
+        expr_ = std::move(other.expr_);
+        consts_ = std::move(other.consts_);
+        argCount_ = other.argCount_;
+        stackDepth_ = other.stackDepth_;
+        page_ = std::exchange(other.page_, nullptr);
+        pageSize_ = other.pageSize_;
+    }
+
+    return *this;
+}
+
+CompiledExpr::~CompiledExpr()
+{
+    Release();
+}
+
+void CompiledExpr::Release() noexcept
+{
+#if CS3910_JIT
+    if(page_ != nullptr)
+        munmap(page_, pageSize_);
+#endif
+    page_ = nullptr;
+}
+
+void CompiledExpr::Eval(
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows,
+    double* out) const
+{
+    if(page_ == nullptr)
+        expr_.Eval(columns, stride, rows, out);
+    else
+        Run(columns, stride, rows, out, consts_.data(), ExprView{expr_});
+}
+
+void CompiledExpr::Eval(
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows,
+    double* out,
+    double const* consts) const
+{
+    auto const Function = ExprView{expr_};
+    auto const Count = Function.ConstCount();
+    auto const Replaced = ExprView{
+        Function.BeginCode(),
+        Function.BeginExtents(),
+        Function.Count(),
+        consts,
+        Count};
+    if(page_ == nullptr)
+    {
+        Replaced.Eval(columns, stride, rows, out);
+        return;
+    }
+
+    std::vector<double> pool(2 * (Count + 1));
+    pool[0] = pool[1] = std::numeric_limits<double>::infinity();
+    for(std::size_t i{}; i != Count; ++i)
+        pool[2 * i + 2] = pool[2 * i + 3] = consts[i];
+    Run(columns, stride, rows, out, pool.data(), Replaced);
+}
+
+void CompiledExpr::Run(
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows,
+    double* out,
+    double const* pool,
+    ExprView expr) const
+{
+    auto const Fn = reinterpret_cast<internal::CompiledFn>(page_);
+    Fn(columns, pool, out, rows / 2, stride * sizeof(double));
+
+    // The odd row out
+    if(rows % 2 != 0)
+        expr.Eval(columns + rows - 1, stride, 1, out + rows - 1);
+
+#ifndef NDEBUG
+    // Check the compiled code against the interpreter
+    if(rows != 0)
+    {
+        std::vector<double> args(argCount_);
+        for(std::size_t i{}; i != argCount_; ++i)
+            args[i] = columns[i * stride];
+        auto const Expected = expr.Eval(args.data());
+        assert((out[0] == Expected
+            || (std::isnan(out[0]) && std::isnan(Expected)))
+            && "Compiled code and interpreter disagree");
+    }
+#endif
+}
+
+Expr const& CompiledExpr::Function() const noexcept
+{
+    return expr_;
+}
+
+#endif // !CS3910__JIT_H_
@@ -0,0 +1,168 @@
+#ifndef CS3910__LINEAR_GP_H_
+#define CS3910__LINEAR_GP_H_
+
+#include "GP.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace internal
+{
+    // An instruction of a linear program, r[dst] = lhs op rhs. The operands
+    // are sources numbered through the registers, then the arguments and
+    // then the constants of the program.
+    struct LinearInstr
+    {
+        std::uint8_t op;
+        std::uint8_t dst;
+        std::uint16_t lhs;
+        std::uint16_t rhs;
+    };
+}
+
+// A linear genetic program, a fixed format sequence of register instructions
+// run straight through with the result left in register 0. Register i starts
+// with argument i modulo the number of arguments, so a register read before
+// it is written is an argument.
+struct LinearProgram
+{
+    std::vector<internal::LinearInstr> code;
+    std::vector<double> consts;
+    std::size_t registerCount;
+    std::size_t argCount;
+};
+
+// Mark the effective instructions of a program, those which may change
+// register 0 at its end. The rest are introns. A backward pass keeps the set
+// of registers which are read later on.
+std::vector<bool> EffectiveInstrs(LinearProgram const& program);
+
+// Copy a program without its introns, which computes the same result.
+LinearProgram RemoveIntrons(LinearProgram const& program);
+
+// Evaluate a program for rows of column-major arguments, a block of rows at
+// a time, every instruction is applied to a whole block. The columns are
+// stride values apart. Introns are evaluated as well, remove them first.
+void EvalLinear(
+    LinearProgram const& program,
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows,
+    double* out);
+
+// Print the program, an instruction to a line.
+std::ostream& operator<<(std::ostream& outs, LinearProgram const& program);
+
+std::vector<bool> EffectiveInstrs(LinearProgram const& program)
+{
+    std::vector<bool> effective(program.code.size());
+    std::vector<bool> live(program.registerCount);
+    live[0] = true;
+    for(auto i = program.code.size(); i-- != 0;)
+    {
+        auto const& Instr = program.code[i];
+        if(!live[Instr.dst])
+            continue;
+
+        effective[i] = true;
+        live[Instr.dst] = false;
+        if(Instr.lhs < program.registerCount)
+            live[Instr.lhs] = true;
+        if(Instr.rhs < program.registerCount)
+            live[Instr.rhs] = true;
+    }
+
+    return effective;
+}
+
+LinearProgram RemoveIntrons(LinearProgram const& program)
+{
+    auto const Effective = EffectiveInstrs(program);
+    LinearProgram result{
+        {},
+        program.consts,
+        program.registerCount,
+        program.argCount};
+    for(std::size_t i{}; i != program.code.size(); ++i)
+        if(Effective[i])
+            result.code.push_back(program.code[i]);
+    return result;
+}
+
+void EvalLinear(
+    LinearProgram const& program,
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows,
+    double* out)
+{
+    constexpr auto Block = internal::EvalBlockSize;
+    auto const Registers = program.registerCount;
+    auto const Args = program.argCount;
+    assert(Registers != 0 && Args != 0 && "Malformed LinearProgram");
+
+    // The constants are filled into blocks once
+    std::vector<double> consts(program.consts.size() * Block);
+    for(std::size_t i{}; i != program.consts.size(); ++i)
+        std::fill_n(consts.data() + i * Block, Block, program.consts[i]);
+
+    std::vector<double> registers(Registers * Block);
+    for(std::size_t row{}; row < rows; row += Block)
+    {
+        auto const Count = std::min(Block, rows - row);
+        auto const Source = [&](std::size_t id) noexcept -> double const*
+        {
+            if(id < Registers)
+                return registers.data() + id * Block;
+            if(id < Registers + Args)
+                return columns + (id - Registers) * stride + row;
+            return consts.data() + (id - Registers - Args) * Block;
+        };
+
+        for(std::size_t i{}; i != Registers; ++i)
+            std::copy_n(
+                columns + (i % Args) * stride + row,
+                Count,
+                registers.data() + i * Block);
+
+        for(auto&& instr: program.code)
+            internal::ApplyOp(
+                instr.op,
+                Source(instr.lhs),
+                Source(instr.rhs),
+                registers.data() + instr.dst * Block,
+                Count);
+
+        std::copy_n(registers.data(), Count, out + row);
+    }
+}
+
+std::ostream& operator<<(std::ostream& outs, LinearProgram const& program)
+{
+    auto const Source = [&](std::size_t id)
+    {
+        auto const Registers = program.registerCount;
+        if(id < Registers)
+            outs << 'r' << id;
+        else if(id < Registers + program.argCount)
+            outs << 'x' << id - Registers;
+        else
+            outs << program.consts[id - Registers - program.argCount];
+    };
+
+    for(auto&& instr: program.code)
+    {
+        outs << 'r' << +instr.dst << " = ";
+        Source(instr.lhs);
+        internal::PrintInfix(instr.op, outs);
+        Source(instr.rhs);
+        outs << '\n';
+    }
+
+    return outs;
+}
+
+#endif // !CS3910__LINEAR_GP_H_
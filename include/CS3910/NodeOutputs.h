@@ -0,0 +1,172 @@
+#ifndef CS3910__NODE_OUTPUTS_H_
+#define CS3910__NODE_OUTPUTS_H_
+
+#include "GP.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+// The outputs of every node of an expression over all rows. An expression
+// which differs from it only in the subtree at one node, such as a child of
+// mutation or crossover, is evaluated by computing the new subtree and then
+// only the ancestors of the node, reading the outputs of every other subtree
+// from here. That takes time in the size of the new subtree plus the depth of
+// the node rather than in the size of the whole expression.
+//
+// The outputs take count * rows values, so they are only worth keeping for
+// the few expressions which are the parents of many children.
+class NodeOutputs final
+{
+public:
+    // Evaluate every node of an expression for rows of column-major
+    // arguments, the columns are stride values apart.
+    NodeOutputs(
+        ExprView expr,
+        double const* columns,
+        std::size_t stride,
+        std::size_t rows);
+
+    // Evaluate the expression with the subtree at a node replaced by
+    // another expression, for the same rows of arguments.
+    void EvalSpliced(
+        std::size_t id,
+        ExprView replacement,
+        double const* columns,
+        std::size_t stride,
+        double* out) const;
+
+    // The same for count rows from the first only, out holds count values.
+    void EvalSpliced(
+        std::size_t id,
+        ExprView replacement,
+        double const* columns,
+        std::size_t stride,
+        std::size_t first,
+        std::size_t count,
+        double* out) const;
+
+    // The values of a node for every row.
+    double const* Output(std::size_t id) const noexcept;
+
+    ExprView Function() const noexcept;
+
+    // The memory held by the outputs in bytes.
+    std::size_t Bytes() const noexcept;
+
+private:
+    Expr function_;
+
+    std::size_t rows_;
+
+    std::vector<double> outputs_;
+};
+
+NodeOutputs::NodeOutputs(
+    ExprView expr,
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows)
+    : function_{expr}
+    , rows_{rows}
+    , outputs_(expr.Count() * rows)
+{
+    // Backwards so that the operands of a node are done before it
+    auto const Code = expr.BeginCode();
+    auto const Extents = expr.BeginExtents();
+    auto constIt = expr.EndConsts();
+    for(auto i = expr.Count(); i-- != 0;)
+    {
+        auto const Out = outputs_.data() + i * rows_;
+        switch (Code[i].op)
+        {
+        case internal::OpCode::LoadConst:
+            std::fill(Out, Out + rows_, *--constIt);
+            break;
+        case internal::OpCode::LoadArg:
+            std::copy_n(columns + Code[i].arg * stride, rows_, Out);
+            break;
+        default:
+            internal::ApplyOp(
+                Code[i].op,
+                Output(i + 1),
+                Output(i + 1 + Extents[i + 1].size),
+                Out,
+                rows_);
+        }
+    }
+}
+
+void NodeOutputs::EvalSpliced(
+    std::size_t id,
+    ExprView replacement,
+    double const* columns,
+    std::size_t stride,
+    double* out) const
+{
+    EvalSpliced(id, replacement, columns, stride, 0, rows_, out);
+}
+
+void NodeOutputs::EvalSpliced(
+    std::size_t id,
+    ExprView replacement,
+    double const* columns,
+    std::size_t stride,
+    std::size_t first,
+    std::size_t count,
+    double* out) const
+{
+    auto const Function = ExprView{function_};
+    assert(id < Function.Count() && "Node out of range");
+    assert(first + count <= rows_ && "Rows out of range");
+    replacement.Eval(columns + first, stride, count, out);
+
+    std::vector<std::size_t> ancestors{};
+    internal::DescendExpr(
+        Function.BeginExtents(),
+        id,
+        [&](auto node) { ancestors.push_back(node); });
+
+    // Climb back up, combining the new output with the kept output of the
+    // sibling on the way
+    auto const Code = Function.BeginCode();
+    auto const Extents = Function.BeginExtents();
+    auto child = id;
+    for(auto i = ancestors.rbegin(); i != ancestors.rend(); ++i)
+    {
+        auto const Lhs = *i + 1;
+        auto const Rhs = Lhs + Extents[Lhs].size;
+        if(child == Lhs)
+            internal::ApplyOp(
+                Code[*i].op,
+                out,
+                Output(Rhs) + first,
+                out,
+                count);
+        else
+            internal::ApplyOp(
+                Code[*i].op,
+                Output(Lhs) + first,
+                out,
+                out,
+                count);
+        child = *i;
+    }
+}
+
+double const* NodeOutputs::Output(std::size_t id) const noexcept
+{
+    return outputs_.data() + id * rows_;
+}
+
+ExprView NodeOutputs::Function() const noexcept
+{
+    return function_;
+}
+
+std::size_t NodeOutputs::Bytes() const noexcept
+{
+    return outputs_.size() * sizeof(double);
+}
+
+#endif // !CS3910__NODE_OUTPUTS_H_
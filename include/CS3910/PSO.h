@@ -3,6 +3,9 @@
 
 #include <execution>
 #include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 struct PSOParameters
 {
@@ -71,6 +74,11 @@ public:
 
     template<typename Compare>
     Individual FindBest(Compare&& compare);
+
+    // Apply the consumer in parallel to the n individuals with the best
+    // personal best fitness.
+    template<typename Compare, typename Consumer>
+    void ForBest(std::size_t n, Compare&& compare, Consumer&& consumer);
 private:
     std::vector<double> positions_;
 
@@ -156,6 +164,53 @@ Particles::Individual Particles::FindBest(Compare&& compare)
     return *it;
 }
 
+template<typename Compare, typename Consumer>
+void Particles::ForBest(std::size_t n, Compare&& compare, Consumer&& consumer)
+{
+    std::vector<Individual*> best(population_.size());
+    std::transform(
+        population_.begin(),
+        population_.end(),
+        best.begin(),
+        [](auto& p) { return &p; });
+
+    auto const Last = best.begin() + std::min(n, best.size());
+    std::partial_sort(
+        best.begin(),
+        Last,
+        best.end(),
+        [&](auto a, auto b)
+        {
+            return compare(a->bestFitness, b->bestFitness);
+        });
+
+    std::for_each(
+        std::execution::par,
+        best.begin(),
+        Last,
+        [&](auto p) { consumer(*p); });
+}
+
+namespace internal
+{
+    // A control policy opts in to the hybrid PSO by providing a local search
+    // Refine(Particles::Individual&) which improves the personal best of a
+    // particle, along with RefinementInterval and RefinementCount.
+    template<typename ControlPolicy, typename = void>
+    struct HasRefine: std::false_type
+    {
+    };
+
+    template<typename ControlPolicy>
+    struct HasRefine<
+        ControlPolicy,
+        std::void_t<decltype(std::declval<ControlPolicy&>().Refine(
+            std::declval<Particles::Individual&>()))>>
+        : std::true_type
+    {
+    };
+}
+
 template<typename EnvT, typename ControlPolicy>
 class BasicPSO: private ControlPolicy
 {
@@ -257,6 +312,16 @@ void BasicPSO<EnvT, ControlPolicy>::Step()
             std::copy(p.position, p.position + Count, p.bestPosition);
         }
     });
+
+    // Hybrid mode, locally improve the best particles every few iterations.
+    // The improved personal bests are picked up as the global best on the
+    // next step.
+    if constexpr(internal::HasRefine<ControlPolicy>::value)
+        if(iteration_ % ControlPolicy::RefinementInterval == 0)
+            particles_.ForBest(
+                ControlPolicy::RefinementCount,
+                ControlPolicy::Compare,
+                [&](auto& p) { this->Refine(p); });
 }
 
 
@@ -6,7 +6,9 @@
 #include <exception>
 #include <fstream>
 #include <iterator>
+#include <numeric>
 #include <string>
+#include <utility>
 #include <vector>
 
 class FailedToReadData final : public std::exception
@@ -43,6 +45,13 @@ class PalletData
 public:
     explicit PalletData(char const* fileName);
 
+    // Copy some of the rows of other data. The weights, if any, give the
+    // number of rows of the data each row stands for in the mean error.
+    PalletData(
+        PalletData const& data,
+        std::vector<std::size_t> const& rows,
+        std::vector<double> weights = {});
+
     inline std::size_t RowCount() const noexcept;
 
     inline std::size_t DataCount() const noexcept;
@@ -59,9 +68,48 @@ public:
 
     inline double const* EndRowData(std::size_t row) const noexcept;
 
+    // The data is also kept column-major, column i starts at
+    // BeginColumnData() + i * RowCount().
+    inline double const* BeginColumnData() const noexcept;
+
+    inline double const* BeginColumn(std::size_t column) const noexcept;
+
+    inline double const* EndColumn(std::size_t column) const noexcept;
+
+    // Whether the rows have weights, otherwise every row weighs one.
+    inline bool Weighted() const noexcept;
+
+    inline double const* BeginWeight() const noexcept;
+
+    // The sum of the weights of the rows.
+    inline double TotalWeight() const noexcept;
+
+    // The least and greatest value of a column.
+    inline double ColumnMin(std::size_t column) const noexcept;
+
+    inline double ColumnMax(std::size_t column) const noexcept;
+
+    // A lower bound on the mean absolute error of any estimates which are
+    // all within a range, the error of clamping the demand to the range.
+    // Takes time logarithmic in the number of rows.
+    double MinError(double lo, double hi) const noexcept;
+
 private:
+    // Precompute the statistics of the columns and the demand
+    void Summarise();
+
     std::vector<double> demand_{};
     std::vector<double> dataPoints_{};
+    std::vector<double> columns_{};
+    std::vector<double> weights_{};
+    std::vector<double> columnMins_{};
+    std::vector<double> columnMaxs_{};
+    // The demand in order, with the sums of the weights and of the weighted
+    // demand before every row
+    std::vector<double> sortedDemand_{};
+    std::vector<double> weightBefore_{};
+    std::vector<double> demandBefore_{};
+    double totalWeight_{};
     std::size_t dataPointCount_{};
 
     template<
@@ -121,6 +169,42 @@ PalletData::PalletData(char const* fileName)
         std::back_inserter(demand_),
         std::back_inserter(dataPoints_)))
         throw FailedToReadData{};
+
+    auto const Rows = demand_.size();
+    columns_.resize(dataPoints_.size());
+    for(std::size_t i{}; i != Rows; ++i)
+        for(std::size_t j{}; j != dataPointCount_; ++j)
+            columns_[j * Rows + i] = dataPoints_[i * dataPointCount_ + j];
+    totalWeight_ = static_cast<double>(Rows);
+    Summarise();
+}
+
+PalletData::PalletData(
+    PalletData const& data,
+    std::vector<std::size_t> const& rows,
+    std::vector<double> weights)
+    : weights_{std::move(weights)}
+    , dataPointCount_{data.dataPointCount_}
+{
+    assert((weights_.empty() || weights_.size() == rows.size())
+        && "A weight for every row");
+    for(auto row: rows)
+    {
+        demand_.push_back(data.BeginDemand()[row]);
+        dataPoints_.insert(
+            dataPoints_.end(),
+            data.BeginRowData(row),
+            data.EndRowData(row));
+    }
+
+    columns_.resize(dataPoints_.size());
+    for(std::size_t j{}; j != dataPointCount_; ++j)
+        for(std::size_t i{}; i != rows.size(); ++i)
+            columns_[j * rows.size() + i] = data.BeginColumn(j)[rows[i]];
+    totalWeight_ = weights_.empty()
+        ? static_cast<double>(rows.size())
+        : std::accumulate(weights_.cbegin(), weights_.cend(), 0.0);
+    Summarise();
 }
 
 std::size_t PalletData::RowCount() const noexcept
@@ -167,4 +251,111 @@ double const* PalletData::EndRowData(std::size_t row)
     return dataPoints_.data() + row * dataPointCount_ + dataPointCount_;
 }
 
+double const* PalletData::BeginColumnData() const noexcept
+{
+    return columns_.data();
+}
+
+double const* PalletData::BeginColumn(std::size_t column) const noexcept
+{
+    assert(column < dataPointCount_ && "Out of bounds column");
+    return columns_.data() + column * demand_.size();
+}
+
+double const* PalletData::EndColumn(std::size_t column) const noexcept
+{
+    assert(column < dataPointCount_ && "Out of bounds column");
+    return columns_.data() + (column + 1) * demand_.size();
+}
+
+bool PalletData::Weighted() const noexcept
+{
+    return !weights_.empty();
+}
+
+double const* PalletData::BeginWeight() const noexcept
+{
+    assert(Weighted() && "The rows have no weights");
+    return weights_.data();
+}
+
+double PalletData::TotalWeight() const noexcept
+{
+    return totalWeight_;
+}
+
+double PalletData::ColumnMin(std::size_t column) const noexcept
+{
+    assert(column < dataPointCount_ && "Out of bounds column");
+    return columnMins_[column];
+}
+
+double PalletData::ColumnMax(std::size_t column) const noexcept
+{
+    assert(column < dataPointCount_ && "Out of bounds column");
+    return columnMaxs_[column];
+}
+
+double PalletData::MinError(double lo, double hi) const noexcept
+{
+    assert(!(hi < lo) && "An empty range");
+    auto const Rows = sortedDemand_.size();
+    if(Rows == 0)
+        return 0.0;
+
+    // The rows below the range each err by lo - demand, those above it by
+    // demand - hi
+    auto const Below = static_cast<std::size_t>(std::lower_bound(
+        sortedDemand_.cbegin(),
+        sortedDemand_.cend(),
+        lo) - sortedDemand_.cbegin());
+    auto const Above = static_cast<std::size_t>(std::upper_bound(
+        sortedDemand_.cbegin(),
+        sortedDemand_.cend(),
+        hi) - sortedDemand_.cbegin());
+    auto error = 0.0;
+    if(Below != 0)
+        error += lo * weightBefore_[Below] - demandBefore_[Below];
+    if(Above != Rows)
+        error += demandBefore_[Rows] - demandBefore_[Above]
+            - hi * (weightBefore_[Rows] - weightBefore_[Above]);
+
+    // Rounding may leave a little below zero
+    return std::max(error, 0.0) / totalWeight_;
+}
+
+void PalletData::Summarise()
+{
+    auto const Rows = demand_.size();
+    columnMins_.resize(dataPointCount_);
+    columnMaxs_.resize(dataPointCount_);
+    for(std::size_t j{}; j != dataPointCount_ && Rows != 0; ++j)
+    {
+        auto const [Min, Max] = std::minmax_element(
+            BeginColumn(j),
+            EndColumn(j));
+        columnMins_[j] = *Min;
+        columnMaxs_[j] = *Max;
+    }
+
+    std::vector<std::size_t> order(Rows);
+    std::iota(order.begin(), order.end(), std::size_t{});
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) noexcept
+    {
+        return demand_[a] < demand_[b];
+    });
+
+    sortedDemand_.resize(Rows);
+    weightBefore_.assign(Rows + 1, 0.0);
+    demandBefore_.assign(Rows + 1, 0.0);
+    for(std::size_t i{}; i != Rows; ++i)
+    {
+        auto const Row = order[i];
+        auto const Weight = weights_.empty() ? 1.0 : weights_[Row];
+        sortedDemand_[i] = demand_[Row];
+        weightBefore_[i + 1] = weightBefore_[i] + Weight;
+        demandBefore_[i + 1] = demandBefore_[i] + Weight * demand_[Row];
+    }
+}
+
 #endif // !CS3910__PALLETS_H_
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef CS3910__PARETO_ARCHIVE_H_
+#define CS3910__PARETO_ARCHIVE_H_
+
+#include "GP.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+// The expressions which no other expression offered beats on both fitness and
+// size, the number of nodes, which is about what an expression costs to
+// evaluate. Where evaluating is costly the smallest expression within an
+// error tolerance of the best is the one to use.
+//
+// The front is kept ordered by size, so the fitness improves from every
+// expression to the next.
+class ParetoArchive final
+{
+public:
+    struct Entry
+    {
+        Expr function;
+        double fitness;
+    };
+
+    // Whether an expression of the fitness and size would be kept, which
+    // is cheaper than offering it.
+    bool Accepts(double fitness, std::size_t size) const noexcept;
+
+    // Keep an expression unless it is dominated, dropping those it
+    // dominates. Returns whether it was kept.
+    bool Insert(ExprView function, double fitness);
+
+    // The smallest expression first.
+    std::vector<Entry> const& Front() const noexcept;
+
+    // The fittest expression, which is the largest. The archive must not be
+    // empty.
+    Entry const& Best() const noexcept;
+
+    bool Empty() const noexcept;
+
+private:
+    // The first entry which is not smaller than the size
+    std::vector<Entry>::const_iterator LowerBound(
+        std::size_t size) const noexcept;
+
+    std::vector<Entry> front_{};
+};
+
+bool ParetoArchive::Accepts(double fitness, std::size_t size) const noexcept
+{
+    if(!(fitness < std::numeric_limits<double>::infinity()))
+        return false;
+
+    // Only the entries of the same size or the next smaller may dominate,
+    // the smaller ones before them are less fit still
+    auto const It = LowerBound(size);
+    if(It != front_.cend()
+        && It->function.Count() == size
+        && It->fitness <= fitness)
+        return false;
+    return It == front_.cbegin() || fitness < std::prev(It)->fitness;
+}
+
+bool ParetoArchive::Insert(ExprView function, double fitness)
+{
+    auto const Size = function.Count();
+    if(!Accepts(fitness, Size))
+        return false;
+
+    // The dominated entries are those from the size on up to the first
+    // which is fitter
+    auto const First = LowerBound(Size);
+    auto const Last = std::find_if(
+        First,
+        front_.cend(),
+        [&](auto const& entry) noexcept { return entry.fitness < fitness; });
+    front_.insert(front_.erase(First, Last), Entry{Expr{function}, fitness});
+    return true;
+}
+
+std::vector<ParetoArchive::Entry> const& ParetoArchive::Front() const noexcept
+{
+    return front_;
+}
+
+ParetoArchive::Entry const& ParetoArchive::Best() const noexcept
+{
+    assert(!front_.empty() && "An empty archive has no best");
+    return front_.back();
+}
+
+bool ParetoArchive::Empty() const noexcept
+{
+    return front_.empty();
+}
+
+std::vector<ParetoArchive::Entry>::const_iterator ParetoArchive::LowerBound(
+    std::size_t size) const noexcept
+{
+    return std::lower_bound(
+        front_.cbegin(),
+        front_.cend(),
+        size,
+        [](auto const& entry, auto size) noexcept
+        {
+            return entry.function.Count() < size;
+        });
+}
+
+#endif // !CS3910__PARETO_ARCHIVE_H_
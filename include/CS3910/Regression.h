@@ -0,0 +1,303 @@
+#ifndef CS3910__REGRESSION_H_
+#define CS3910__REGRESSION_H_
+
+#include "Pallets.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+namespace internal
+{
+    // Compute the residuals x_i . w - y_i for every row of the data.
+    template<typename RandomWeightIt, typename OutputIt>
+    OutputIt Residuals(
+        PalletData const& data,
+        RandomWeightIt weightIt,
+        OutputIt outIt)
+    {
+        for(std::size_t i{}; i != data.RowCount(); ++i, ++outIt)
+            *outIt = std::inner_product(
+                data.BeginRowData(i),
+                data.EndRowData(i),
+                weightIt,
+                -data.BeginDemand()[i]);
+        return outIt;
+    }
+
+    // Solve the symmetric positive definite system A x = b using a Cholesky
+    // factorisation. A is row-major and n by n, both A and b are overwritten
+    // and b holds the solution.
+    bool SolveCholesky(
+        std::vector<double>& a,
+        std::vector<double>& b,
+        std::size_t n)
+    {
+        for(std::size_t j{}; j != n; ++j)
+        {
+            auto diagonal = a[j * n + j];
+            for(std::size_t k{}; k != j; ++k)
+                diagonal -= a[j * n + k] * a[j * n + k];
+            if(!(0.0 < diagonal))
+                return false;
+            a[j * n + j] = std::sqrt(diagonal);
+
+            for(auto i = j + 1; i != n; ++i)
+            {
+                auto x = a[i * n + j];
+                for(std::size_t k{}; k != j; ++k)
+                    x -= a[i * n + k] * a[j * n + k];
+                a[i * n + j] = x / a[j * n + j];
+            }
+        }
+
+        // Forward substitution L y = b
+        for(std::size_t i{}; i != n; ++i)
+        {
+            for(std::size_t k{}; k != i; ++k)
+                b[i] -= a[i * n + k] * b[k];
+            b[i] /= a[i * n + i];
+        }
+
+        // Backward substitution L^T x = y
+        for(auto i = n; i-- != 0;)
+        {
+            for(auto k = i + 1; k != n; ++k)
+                b[i] -= a[k * n + i] * b[k];
+            b[i] /= a[i * n + i];
+        }
+
+        return true;
+    }
+
+    // Find the step t minimising sum |r_i + t z_i|, which is the weighted
+    // median of the break points -r_i / z_i weighted by |z_i|.
+    double LineSearchAbsoluteDeviation(
+        double const* residuals,
+        double const* direction,
+        std::size_t count)
+    {
+        std::vector<std::pair<double, double>> points{};
+        double total{};
+        for(std::size_t i{}; i != count; ++i)
+            if(direction[i] != 0.0)
+            {
+                auto const W = std::abs(direction[i]);
+                points.emplace_back(-residuals[i] / direction[i], W);
+                total += W;
+            }
+
+        std::sort(points.begin(), points.end());
+        double acc{};
+        for(auto&& [t, w]: points)
+            if(total <= 2 * (acc += w))
+                return t;
+        return 0.0;
+    }
+
+    // Move the weights by a step along a direction if that lowers the
+    // absolute deviation, the residuals are kept in step with the weights.
+    bool StepAbsoluteDeviation(
+        PalletData const& data,
+        double* weights,
+        double* residuals,
+        double const* direction,
+        std::vector<double>& change)
+    {
+        auto const Rows = data.RowCount();
+        auto const Count = data.DataCount();
+        for(std::size_t i{}; i != Rows; ++i)
+            change[i] = std::inner_product(
+                data.BeginRowData(i),
+                data.EndRowData(i),
+                direction,
+                0.0);
+
+        auto const T = LineSearchAbsoluteDeviation(
+            residuals,
+            change.data(),
+            Rows);
+        double before{};
+        double after{};
+        for(std::size_t i{}; i != Rows; ++i)
+        {
+            before += std::abs(residuals[i]);
+            after += std::abs(residuals[i] + T * change[i]);
+        }
+
+        if(!(after < before * (1 - 1e-12)))
+            return false;
+
+        for(std::size_t j{}; j != Count; ++j)
+            weights[j] += T * direction[j];
+        for(std::size_t i{}; i != Rows; ++i)
+            residuals[i] += T * change[i];
+        return true;
+    }
+}
+
+// Solve the weighted least squares problem min sum w_i (x_i . b - y_i)^2 by
+// forming the normal equations. A small ridge keeps columns which are
+// constant zero in the data from making the system singular.
+template<typename InputWeightIt>
+std::vector<double> SolveWeightedLeastSquares(
+    PalletData const& data,
+    InputWeightIt weightIt)
+{
+    auto const Count = data.DataCount();
+    std::vector<double> a(Count * Count);
+    std::vector<double> b(Count);
+    for(std::size_t r{}; r != data.RowCount(); ++r, ++weightIt)
+    {
+        auto const W = *weightIt;
+        auto const* x = data.BeginRowData(r);
+        auto const Y = data.BeginDemand()[r];
+        for(std::size_t i{}; i != Count; ++i)
+        {
+            b[i] += W * x[i] * Y;
+            for(std::size_t j{}; j <= i; ++j)
+                a[i * Count + j] += W * x[i] * x[j];
+        }
+    }
+
+    double trace{};
+    for(std::size_t i{}; i != Count; ++i)
+        trace += a[i * Count + i];
+    auto const Ridge = 1e-9 * (trace / Count) + 1e-12;
+    for(std::size_t i{}; i != Count; ++i)
+    {
+        a[i * Count + i] += Ridge;
+        for(std::size_t j{}; j != i; ++j)
+            a[j * Count + i] = a[i * Count + j];
+    }
+
+    if(!internal::SolveCholesky(a, b, Count))
+        std::fill(b.begin(), b.end(), 0.0);
+    return b;
+}
+
+// Ordinary least squares fit of the demand.
+std::vector<double> SolveLeastSquares(PalletData const& data)
+{
+    std::vector<double> weights(data.RowCount(), 1.0);
+    return SolveWeightedLeastSquares(data, weights.cbegin());
+}
+
+// Least absolute deviation fit of the demand using iteratively reweighted
+// least squares, starting from the least squares solution. The solution with
+// the lowest mean absolute error seen is returned.
+std::vector<double> SolveLeastAbsoluteDeviation(
+    PalletData const& data,
+    std::size_t iterations = 100)
+{
+    auto const Rows = data.RowCount();
+    auto const Scale = std::accumulate(
+        data.BeginDemand(),
+        data.EndDemand(),
+        0.0,
+        [](auto acc, auto y) { return acc + std::abs(y); }) / Rows;
+    // The floor on the residuals smoothing the weights starts loose and
+    // tightens over the iterations, starting with a tight floor lets the fit
+    // lock onto the wrong rows.
+    auto const MinEpsilon = 1e-8 * Scale + std::numeric_limits<double>::min();
+    auto epsilon = 0.1 * Scale + MinEpsilon;
+
+    auto solution = SolveLeastSquares(data);
+    auto best = solution;
+    auto bestError = std::numeric_limits<double>::infinity();
+
+    std::vector<double> residuals(Rows);
+    std::vector<double> weights(Rows);
+    for(std::size_t k{}; k <= iterations; ++k)
+    {
+        internal::Residuals(data, solution.cbegin(), residuals.begin());
+        auto const Error = std::accumulate(
+            residuals.cbegin(),
+            residuals.cend(),
+            0.0,
+            [](auto acc, auto r) { return acc + std::abs(r); }) / Rows;
+
+        if(Error < bestError)
+        {
+            // Stop once the fit no longer improves noticeably.
+            auto const Converged = bestError - Error < 1e-12 * Scale
+                && epsilon <= MinEpsilon;
+            bestError = Error;
+            best = solution;
+            if(Converged)
+                break;
+        }
+
+        epsilon = std::max(epsilon * 0.8, MinEpsilon);
+        std::transform(
+            residuals.cbegin(),
+            residuals.cend(),
+            weights.begin(),
+            [&](auto r) { return 1.0 / std::max(std::abs(r), epsilon); });
+        solution = SolveWeightedLeastSquares(data, weights.cbegin());
+    }
+
+    return best;
+}
+
+// Refine a linear fit of the demand by exact line searches along the
+// subgradient X^T sign(Xw - y) of the absolute deviation, falling back to a
+// sweep of coordinate descent when the subgradient is not a descent
+// direction. The residuals Xw - y must match the weights and are updated in
+// place. Returns the mean absolute error of the refined weights.
+double DescendLeastAbsoluteDeviation(
+    PalletData const& data,
+    double* weights,
+    double* residuals,
+    std::size_t steps)
+{
+    auto const Rows = data.RowCount();
+    auto const Count = data.DataCount();
+    std::vector<double> direction(Count);
+    std::vector<double> change(Rows);
+    for(std::size_t k{}; k != steps; ++k)
+    {
+        std::fill(direction.begin(), direction.end(), 0.0);
+        for(std::size_t i{}; i != Rows; ++i)
+        {
+            auto const Sign = (0.0 < residuals[i]) - (residuals[i] < 0.0);
+            auto const* x = data.BeginRowData(i);
+            for(std::size_t j{}; j != Count; ++j)
+                direction[j] -= Sign * x[j];
+        }
+
+        if(internal::StepAbsoluteDeviation(
+            data,
+            weights,
+            residuals,
+            direction.data(),
+            change))
+            continue;
+
+        auto improved = false;
+        for(std::size_t j{}; j != Count; ++j)
+        {
+            std::fill(direction.begin(), direction.end(), 0.0);
+            direction[j] = 1.0;
+            improved |= internal::StepAbsoluteDeviation(
+                data,
+                weights,
+                residuals,
+                direction.data(),
+                change);
+        }
+
+        if(!improved)
+            break;
+    }
+
+    return std::accumulate(
+        residuals,
+        residuals + Rows,
+        0.0,
+        [](auto acc, auto r) { return acc + std::abs(r); }) / Rows;
+}
+
+#endif // !CS3910__REGRESSION_H_
@@ -0,0 +1,167 @@
+#ifndef CS3910__SPSC_QUEUE_H_
+#define CS3910__SPSC_QUEUE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// A bounded lock-free queue for a single producer thread and a single
+// consumer thread. A try to push to a full queue or to pop from an empty one
+// fails instead of waiting. A push or pop which waits puts its thread to
+// sleep, and the other side only takes a lock to wake it while it sleeps.
+template<typename T>
+class SpscQueue final
+{
+public:
+    explicit SpscQueue(std::size_t capacity);
+
+    SpscQueue(SpscQueue const&) = delete;
+
+    SpscQueue& operator=(SpscQueue const&) = delete;
+
+    // Called by the producer only, the value is left alone when the queue
+    // is full.
+    bool TryPush(T&& value);
+
+    // Called by the consumer only.
+    std::optional<T> TryPop();
+
+    // Called by the producer only, waits while the queue is full.
+    void Push(T&& value);
+
+    // Called by the consumer only, waits for a value until the queue is
+    // closed. Only returns no value once the queue is closed and empty.
+    std::optional<T> Pop();
+
+    // Called by the producer once it has pushed its last value.
+    void Close();
+
+private:
+    // Sleep until ready returns true, it is called again whenever the
+    // other side may have made progress.
+    template<typename F>
+    void Wait(F&& ready);
+
+    // Wake the other side if it sleeps, after making progress.
+    void Wake();
+
+    // One slot is always left empty to tell a full queue from an empty one
+    std::size_t const Size_;
+
+    std::unique_ptr<std::optional<T>[]> slots_;
+
+    // The next slot to pop, written by the consumer
+    alignas(64) std::atomic<std::size_t> head_{};
+
+    // The next slot to push, written by the producer
+    alignas(64) std::atomic<std::size_t> tail_{};
+
+    std::atomic<bool> closed_{};
+
+    // The number of sides asleep, or about to sleep
+    std::atomic<std::size_t> sleepers_{};
+
+    std::mutex mutex_{};
+
+    std::condition_variable changed_{};
+};
+
+template<typename T>
+SpscQueue<T>::SpscQueue(std::size_t capacity)
+    : Size_{capacity + 1}
+    , slots_{std::make_unique<std::optional<T>[]>(capacity + 1)}
+{
+}
+
+template<typename T>
+bool SpscQueue<T>::TryPush(T&& value)
+{
+    auto const Tail = tail_.load(std::memory_order_relaxed);
+    auto const Next = (Tail + 1) % Size_;
+    if(Next == head_.load(std::memory_order_acquire))
+        return false;
+
+    slots_[Tail] = std::move(value);
+    tail_.store(Next, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+std::optional<T> SpscQueue<T>::TryPop()
+{
+    auto const Head = head_.load(std::memory_order_relaxed);
+    if(Head == tail_.load(std::memory_order_acquire))
+        return std::nullopt;
+
+    auto value = std::move(slots_[Head]);
+    slots_[Head].reset();
+    head_.store((Head + 1) % Size_, std::memory_order_release);
+    return value;
+}
+
+template<typename T>
+void SpscQueue<T>::Push(T&& value)
+{
+    Wait([&]() { return TryPush(std::move(value)); });
+    Wake();
+}
+
+template<typename T>
+std::optional<T> SpscQueue<T>::Pop()
+{
+    std::optional<T> value{};
+    Wait([&]()
+    {
+        // Closed is read first so that the last value is not missed
+        auto const Closed = closed_.load();
+        value = TryPop();
+        return value || Closed;
+    });
+    if(value)
+        Wake();
+    return value;
+}
+
+template<typename T>
+void SpscQueue<T>::Close()
+{
+    closed_.store(true);
+    Wake();
+}
+
+template<typename T>
+template<typename F>
+void SpscQueue<T>::Wait(F&& ready)
+{
+    if(ready())
+        return;
+
+    // Either this side sees the progress of the other when it checks again
+    // or the other sees it going to sleep, see Wake
+    std::unique_lock<std::mutex> lock{mutex_};
+    sleepers_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while(!ready())
+        changed_.wait(lock);
+    sleepers_.fetch_sub(1);
+}
+
+template<typename T>
+void SpscQueue<T>::Wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleepers_.load(std::memory_order_relaxed) == 0)
+        return;
+
+    // A sleeper holds the lock from checking until it sleeps
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+    }
+    changed_.notify_all();
+}
+
+#endif // !CS3910__SPSC_QUEUE_H_
@@ -0,0 +1,463 @@
+#ifndef CS3910__SUBTREE_STORE_H_
+#define CS3910__SUBTREE_STORE_H_
+
+#include "GP.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A hash-consed DAG of the subtrees of a whole population, structurally
+// identical subtrees of any of the expressions are a single node. The output
+// of a node shared by several expressions of a generation is computed once
+// over all rows and kept in a least recently used cache within a memory
+// budget, so evaluating the population costs about the number of unique
+// subtrees rather than the sum of the sizes of the expressions. The nodes
+// which are not shared are evaluated a block of rows at a time in scratch
+// memory kept by each thread.
+//
+// NewGeneration, Insert and Prune are not thread-safe, Eval may be called
+// from several threads once the expressions have been inserted.
+class SubtreeStore final
+{
+public:
+    using NodeId = std::uint32_t;
+
+    // The values of a node for every row, an argument points straight into
+    // its column.
+    using Output = std::shared_ptr<double const>;
+
+    // The memory budget is the size in bytes of the cached outputs.
+    explicit SubtreeStore(std::size_t memoryBudget);
+
+    // Count the uses of the nodes afresh, a node is shared when several of
+    // the expressions inserted from now on have it.
+    void NewGeneration() noexcept;
+
+    // Add an expression to the store, returns the node of its root.
+    NodeId Insert(ExprView expr);
+
+    // Drop the cached outputs of the nodes which are not shared by the
+    // expressions of this generation, once they have all been inserted.
+    void Prune();
+
+    // Evaluate a node for rows of column-major arguments, the columns are
+    // stride values apart. The data must not change without a Clear.
+    Output Eval(
+        NodeId id,
+        double const* columns,
+        std::size_t stride,
+        std::size_t rows);
+
+    // Forget all nodes and cached outputs.
+    void Clear();
+
+    std::size_t NodeCount() const noexcept;
+
+    // The fraction of the shared node evaluations found in the cache.
+    double HitRate() const;
+
+private:
+    constexpr static NodeId None = ~NodeId{};
+
+    struct Node
+    {
+        internal::Instr instr;
+        double value;
+        NodeId lhs;
+        NodeId rhs;
+        std::size_t uses;
+        std::size_t generation;
+    };
+
+    struct Key
+    {
+        internal::Instr instr;
+        std::uint64_t value;
+        NodeId lhs;
+        NodeId rhs;
+
+        bool operator==(Key const& other) const noexcept
+        {
+            return instr == other.instr
+                && value == other.value
+                && lhs == other.lhs
+                && rhs == other.rhs;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(Key const& key) const noexcept
+        {
+            return static_cast<std::size_t>(internal::HashNode(
+                key.instr,
+                key.value,
+                key.lhs,
+                key.rhs));
+        }
+    };
+
+    struct CacheEntry
+    {
+        Output output;
+        std::size_t bytes;
+        std::list<NodeId>::iterator position;
+    };
+
+    // The outputs of the shared nodes below a node, reached only through
+    // nodes which are not shared, and the height of those nodes.
+    struct Inputs
+    {
+        std::vector<std::pair<NodeId, Output>> outputs;
+        std::size_t height;
+    };
+
+    NodeId Intern(Key const& key, double value);
+
+    bool Shared(NodeId id) const noexcept;
+
+    // Find the shared nodes below a node, returns the height of the nodes
+    // passed through.
+    std::size_t CollectInputs(
+        NodeId id,
+        std::vector<std::pair<NodeId, Output>>& outputs) const;
+
+    // Evaluate a node over count rows from the first into out, or point at
+    // its values where they are already known. The scratch holds two
+    // blocks for every level of the nodes passed through.
+    double const* EvalBlock(
+        NodeId id,
+        Inputs const& inputs,
+        double const* columns,
+        std::size_t stride,
+        std::size_t first,
+        std::size_t count,
+        double* out,
+        double* scratch) const;
+
+    Output Find(NodeId id);
+
+    void Store(NodeId id, Output const& output, std::size_t rows);
+
+    std::vector<Node> nodes_{};
+
+    std::size_t generation_{};
+
+    std::unordered_map<Key, NodeId, KeyHash> index_{};
+
+    mutable std::mutex mutex_{};
+
+    std::unordered_map<NodeId, CacheEntry> cache_{};
+
+    std::list<NodeId> recent_{};
+
+    std::size_t cachedBytes_{};
+
+    std::size_t hits_{};
+
+    std::size_t misses_{};
+
+    std::size_t const MemoryBudget_;
+};
+
+SubtreeStore::SubtreeStore(std::size_t memoryBudget)
+    : MemoryBudget_{memoryBudget}
+{
+}
+
+void SubtreeStore::NewGeneration() noexcept
+{
+    ++generation_;
+}
+
+SubtreeStore::NodeId SubtreeStore::Insert(ExprView expr)
+{
+    auto constIt = expr.EndConsts();
+    std::vector<NodeId> stack{};
+    for(auto i = expr.EndCode(); i != expr.BeginCode();)
+    {
+        --i;
+        if(internal::IsTerminal(i->op))
+        {
+            double value{};
+            if(i->op == internal::OpCode::LoadConst)
+                value = *--constIt;
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            stack.push_back(Intern(Key{*i, bits, None, None}, value));
+            continue;
+        }
+
+        auto const Lhs = stack.back();
+        stack.pop_back();
+        stack.back() = Intern(Key{*i, 0, Lhs, stack.back()}, 0.0);
+    }
+
+    assert(stack.size() == 1 && "Malformed Expr");
+    return stack.back();
+}
+
+SubtreeStore::NodeId SubtreeStore::Intern(Key const& key, double value)
+{
+    auto [it, inserted] = index_.try_emplace(
+        key,
+        static_cast<NodeId>(nodes_.size()));
+    if(inserted)
+        nodes_.push_back(Node{
+            key.instr,
+            value,
+            key.lhs,
+            key.rhs,
+            0,
+            generation_});
+
+    auto& node = nodes_[it->second];
+    if(node.generation != generation_)
+    {
+        node.uses = 0;
+        node.generation = generation_;
+    }
+    ++node.uses;
+    return it->second;
+}
+
+void SubtreeStore::Prune()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    for(auto it = cache_.begin(); it != cache_.end();)
+    {
+        if(Shared(it->first))
+        {
+            ++it;
+            continue;
+        }
+
+        cachedBytes_ -= it->second.bytes;
+        recent_.erase(it->second.position);
+        it = cache_.erase(it);
+    }
+}
+
+bool SubtreeStore::Shared(NodeId id) const noexcept
+{
+    auto const& Node = nodes_[id];
+    return Node.generation == generation_
+        && 1 < Node.uses
+        && !internal::IsTerminal(Node.instr.op);
+}
+
+SubtreeStore::Output SubtreeStore::Eval(
+    NodeId id,
+    double const* columns,
+    std::size_t stride,
+    std::size_t rows)
+{
+    auto const& Node = nodes_[id];
+    if(Node.instr.op == internal::OpCode::LoadArg)
+        return Output{Output{}, columns + Node.instr.arg * stride};
+
+    auto const IsShared = Shared(id);
+    if(IsShared)
+        if(auto output = Find(id))
+            return output;
+
+    // The shared nodes below are evaluated over all rows first, the rest a
+    // block at a time
+    Inputs inputs{};
+    inputs.height = Node.instr.op == internal::OpCode::LoadConst
+        ? 0
+        : 1 + std::max(
+            CollectInputs(Node.lhs, inputs.outputs),
+            CollectInputs(Node.rhs, inputs.outputs));
+    std::sort(
+        inputs.outputs.begin(),
+        inputs.outputs.end(),
+        [](auto const& a, auto const& b) noexcept
+        {
+            return a.first < b.first;
+        });
+    inputs.outputs.erase(
+        std::unique(
+            inputs.outputs.begin(),
+            inputs.outputs.end(),
+            [](auto const& a, auto const& b) noexcept
+            {
+                return a.first == b.first;
+            }),
+        inputs.outputs.end());
+    for(auto& [input, output]: inputs.outputs)
+        output = Eval(input, columns, stride, rows);
+
+    thread_local std::vector<double> scratch{};
+    scratch.resize(std::max(
+        scratch.size(),
+        2 * inputs.height * internal::EvalBlockSize));
+    std::shared_ptr<double> output{
+        new double[rows],
+        std::default_delete<double[]>{}};
+    for(std::size_t first{}; first < rows; first += internal::EvalBlockSize)
+    {
+        auto const Count = std::min(internal::EvalBlockSize, rows - first);
+        auto const Values = EvalBlock(
+            id,
+            inputs,
+            columns,
+            stride,
+            first,
+            Count,
+            output.get() + first,
+            scratch.data());
+        if(Values != output.get() + first)
+            std::copy(Values, Values + Count, output.get() + first);
+    }
+
+    if(IsShared)
+        Store(id, output, rows);
+    return output;
+}
+
+std::size_t SubtreeStore::CollectInputs(
+    NodeId id,
+    std::vector<std::pair<NodeId, Output>>& outputs) const
+{
+    auto const& Node = nodes_[id];
+    if(internal::IsTerminal(Node.instr.op))
+        return 0;
+    if(Shared(id))
+    {
+        outputs.emplace_back(id, nullptr);
+        return 0;
+    }
+
+    return 1 + std::max(
+        CollectInputs(Node.lhs, outputs),
+        CollectInputs(Node.rhs, outputs));
+}
+
+double const* SubtreeStore::EvalBlock(
+    NodeId id,
+    Inputs const& inputs,
+    double const* columns,
+    std::size_t stride,
+    std::size_t first,
+    std::size_t count,
+    double* out,
+    double* scratch) const
+{
+    auto const& Node = nodes_[id];
+    switch (Node.instr.op)
+    {
+    case internal::OpCode::LoadArg:
+        return columns + Node.instr.arg * stride + first;
+    case internal::OpCode::LoadConst:
+        std::fill(out, out + count, Node.value);
+        return out;
+    }
+
+    // The shared nodes are inputs, but for the node being evaluated
+    if(Shared(id))
+    {
+        auto const It = std::lower_bound(
+            inputs.outputs.cbegin(),
+            inputs.outputs.cend(),
+            id,
+            [](auto const& input, NodeId x) noexcept
+            {
+                return input.first < x;
+            });
+        if(It != inputs.outputs.cend() && It->first == id)
+            return It->second.get() + first;
+    }
+
+    constexpr auto Block = internal::EvalBlockSize;
+    auto const Lhs = EvalBlock(
+        Node.lhs,
+        inputs,
+        columns,
+        stride,
+        first,
+        count,
+        scratch,
+        scratch + 2 * Block);
+    auto const Rhs = EvalBlock(
+        Node.rhs,
+        inputs,
+        columns,
+        stride,
+        first,
+        count,
+        scratch + Block,
+        scratch + 2 * Block);
+    internal::ApplyOp(Node.instr.op, Lhs, Rhs, out, count);
+    return out;
+}
+
+SubtreeStore::Output SubtreeStore::Find(NodeId id)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto const It = cache_.find(id);
+    if(It == cache_.end())
+    {
+        ++misses_;
+        return nullptr;
+    }
+
+    ++hits_;
+    recent_.splice(recent_.begin(), recent_, It->second.position);
+    return It->second.output;
+}
+
+void SubtreeStore::Store(NodeId id, Output const& output, std::size_t rows)
+{
+    auto const Bytes = rows * sizeof(double);
+    std::lock_guard<std::mutex> lock{mutex_};
+    if(MemoryBudget_ < Bytes || cache_.count(id) != 0)
+        return;
+
+    // Evict the least recently used outputs to make room
+    while(MemoryBudget_ < cachedBytes_ + Bytes)
+    {
+        auto const It = cache_.find(recent_.back());
+        cachedBytes_ -= It->second.bytes;
+        cache_.erase(It);
+        recent_.pop_back();
+    }
+
+    recent_.push_front(id);
+    cache_.emplace(id, CacheEntry{output, Bytes, recent_.begin()});
+    cachedBytes_ += Bytes;
+}
+
+void SubtreeStore::Clear()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    nodes_.clear();
+    index_.clear();
+    cache_.clear();
+    recent_.clear();
+    cachedBytes_ = 0;
+    hits_ = 0;
+    misses_ = 0;
+}
+
+std::size_t SubtreeStore::NodeCount() const noexcept
+{
+    return nodes_.size();
+}
+
+double SubtreeStore::HitRate() const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto const Total = hits_ + misses_;
+    return Total == 0 ? 0.0 : static_cast<double>(hits_) / Total;
+}
+
+#endif // !CS3910__SUBTREE_STORE_H_
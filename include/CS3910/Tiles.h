@@ -0,0 +1,87 @@
+#ifndef CS3910__TILES_H_
+#define CS3910__TILES_H_
+
+#include "GP.h"
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+// The evaluation of a population over many rows split into tiles, a block of
+// rows of a single individual each, so that a small population still keeps
+// every core busy and a few large individuals do not finish long after the
+// rest. The error of an individual is the sum over its tiles.
+
+struct EvalTile
+{
+    std::size_t individual;
+    std::size_t first;
+    std::size_t count;
+};
+
+// The work of evaluating an individual per row, about its number of nodes.
+// An individual with no cost is not evaluated, one which is not splittable
+// is evaluated in a single tile over all rows.
+struct EvalCost
+{
+    std::size_t perRow;
+    bool splittable;
+};
+
+// Split the evaluation into tiles of about equal work, TilesPerWorker for
+// every worker, though never of fewer than MinRows rows. The tiles are
+// ordered by work, the largest first, so that when they are handed out in
+// order the small ones fill in at the end.
+std::vector<EvalTile> SplitTiles(
+    std::vector<EvalCost> const& costs,
+    std::size_t rows,
+    std::size_t workers);
+
+std::vector<EvalTile> SplitTiles(
+    std::vector<EvalCost> const& costs,
+    std::size_t rows,
+    std::size_t workers)
+{
+    constexpr std::size_t TilesPerWorker = 8;
+    // A whole number of the blocks of the interpreter
+    constexpr std::size_t MinRows = 4 * internal::EvalBlockSize;
+
+    auto const Total = std::accumulate(
+        costs.cbegin(),
+        costs.cend(),
+        std::size_t{},
+        [&](auto acc, auto const& cost) { return acc + cost.perRow * rows; });
+    auto const Target = std::max<std::size_t>(
+        Total / (std::max<std::size_t>(workers, 1) * TilesPerWorker),
+        1);
+
+    std::vector<EvalTile> tiles{};
+    for(std::size_t i{}; i != costs.size(); ++i)
+    {
+        auto const Work = costs[i].perRow * rows;
+        if(Work == 0)
+            continue;
+
+        auto const MaxTiles = costs[i].splittable
+            ? std::max<std::size_t>(rows / MinRows, 1)
+            : 1;
+        auto const Count = std::min((Work + Target - 1) / Target, MaxTiles);
+        auto const Block = internal::EvalBlockSize;
+        auto const Size = ((rows + Count - 1) / Count + Block - 1)
+            / Block * Block;
+        for(std::size_t first{}; first < rows; first += Size)
+            tiles.push_back(EvalTile{i, first, std::min(Size, rows - first)});
+    }
+
+    std::stable_sort(
+        tiles.begin(),
+        tiles.end(),
+        [&](auto const& a, auto const& b) noexcept
+        {
+            return costs[b.individual].perRow * b.count
+                < costs[a.individual].perRow * a.count;
+        });
+    return tiles;
+}
+
+#endif // !CS3910__TILES_H_
@@ -0,0 +1,286 @@
+// Microbenchmarks of the hot kernels of the GP, see Bench.h. The optional
+// argument picks the benchmarks whose name contains it, the results are
+// written as a line of JSON per run.
+#define CS3910_NO_MAIN
+#include "GP-Main.cpp"
+#include "CS3910/Bench.h"
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+// A full tree of about the number of nodes with random operators and
+// terminals.
+Expr RandomExpr(std::size_t nodes, std::size_t argCount, std::uint32_t seed);
+
+int main(int argc, char const** argv)
+{
+    // The columns of the sample data
+    constexpr std::size_t Columns = 13;
+
+    BenchSuite suite{};
+    suite.Add(
+        "PalletData/Load",
+        ParamGrid({
+            {"rows", {1000, 10000, 100000}},
+            {"columns", {4, Columns, 32}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const FileName = std::make_shared<std::string>(
+                (std::filesystem::temp_directory_path()
+                    / "cs3910-bench-load.csv").string());
+            WriteRandomPalletData(
+                *FileName,
+                Param(params, "rows"),
+                Param(params, "columns"),
+                1);
+
+            // The file is removed with the last copy of the body
+            std::shared_ptr<void> remove{
+                nullptr,
+                [FileName](void*) { std::remove(FileName->c_str()); }};
+            return [FileName, remove]
+            {
+                PalletData data{FileName->c_str()};
+                KeepValue(data.RowCount());
+            };
+        });
+
+    // Estemate picks the kernel by the rows, so the kernel is a parameter of
+    // its own to keep every series on one kernel. The compiled one includes
+    // the compiling.
+    std::vector<std::size_t> jit{0};
+    if(CompiledExpr::Available)
+        jit.push_back(1);
+    suite.Add(
+        "Estemate/Tree",
+        ParamGrid({
+            {"rows", {1000, 10000, 100000}},
+            {"columns", {Columns}},
+            {"nodes", {7, 31, 127, 511}},
+            {"jit", jit}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Data = std::make_shared<PalletData>(RandomPalletData(
+                Param(params, "rows"),
+                Param(params, "columns"),
+                1));
+            auto const Function = std::make_shared<Expr>(RandomExpr(
+                Param(params, "nodes"),
+                Data->DataCount(),
+                2));
+            auto const Jit = Param(params, "jit") != 0;
+            return [Data, Function, Jit]
+            {
+                std::vector<double> estemates(Data->RowCount());
+                if(Jit)
+                    CompiledExpr{*Function}.Eval(
+                        Data->BeginColumnData(),
+                        Data->RowCount(),
+                        Data->RowCount(),
+                        estemates.data());
+                else
+                    Function->Eval(
+                        Data->BeginColumnData(),
+                        Data->RowCount(),
+                        Data->RowCount(),
+                        estemates.data());
+                KeepValue(Estemate(*Data, estemates.data()));
+            };
+        });
+
+    suite.Add(
+        "EvalExpr/Row",
+        ParamGrid({
+            {"rows", {1000, 10000}},
+            {"columns", {Columns}},
+            {"nodes", {7, 31, 127, 511}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Data = std::make_shared<PalletData>(RandomPalletData(
+                Param(params, "rows"),
+                Param(params, "columns"),
+                1));
+            auto const Function = std::make_shared<Expr>(RandomExpr(
+                Param(params, "nodes"),
+                Data->DataCount(),
+                2));
+            auto const Stack = std::make_shared<std::vector<double>>(
+                internal::StackDepthExpr(
+                    ExprView{*Function}.BeginCode(),
+                    ExprView{*Function}.EndCode()));
+            return [Data, Function, Stack]
+            {
+                auto const View = ExprView{*Function};
+                auto total = 0.0;
+                for(std::size_t i{}; i != Data->RowCount(); ++i)
+                    total += internal::EvalExpr(
+                        View.BeginCode(),
+                        View.EndCode(),
+                        View.EndConsts(),
+                        Data->BeginRowData(i),
+                        Stack->data());
+                KeepValue(total);
+            };
+        });
+
+    suite.Add(
+        "Expr::Eval/Block",
+        ParamGrid({
+            {"rows", {1000, 10000, 100000}},
+            {"columns", {Columns}},
+            {"nodes", {7, 31, 127, 511}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Data = std::make_shared<PalletData>(RandomPalletData(
+                Param(params, "rows"),
+                Param(params, "columns"),
+                1));
+            auto const Function = std::make_shared<Expr>(RandomExpr(
+                Param(params, "nodes"),
+                Data->DataCount(),
+                2));
+            auto const Out = std::make_shared<std::vector<double>>(
+                Data->RowCount());
+            return [Data, Function, Out]
+            {
+                Function->Eval(
+                    Data->BeginColumnData(),
+                    Data->RowCount(),
+                    Data->RowCount(),
+                    Out->data());
+                KeepValue(Out->front());
+            };
+        });
+
+    suite.Add(
+        "SubtreeCrossover",
+        ParamGrid({{"nodes", {7, 31, 127, 511}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Nodes = Param(params, "nodes");
+            auto const A = std::make_shared<Expr>(
+                RandomExpr(Nodes, Columns, 1));
+            auto const B = std::make_shared<Expr>(
+                RandomExpr(Nodes, Columns, 2));
+            auto const Rng = std::make_shared<std::minstd_rand>(3);
+            return [A, B, Rng, Nodes]
+            {
+                auto const [ChildA, ChildB] = SubtreeCrossover(
+                    *A,
+                    *B,
+                    4 * Nodes,
+                    *Rng);
+                KeepValue(ChildA.Count() + ChildB.Count());
+            };
+        });
+
+    // The selection weights of a generation, built once per generation
+    suite.Add(
+        "AliasTable::Build",
+        ParamGrid({{"population", {100, 1000, 10000}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Rng = std::make_shared<std::minstd_rand>(1);
+            auto const Fitness = std::make_shared<std::vector<double>>(
+                Param(params, "population"));
+            for(auto& fitness: *Fitness)
+                fitness = std::uniform_real_distribution<>{1, 100}(*Rng);
+            auto const Table = std::make_shared<AliasTable>();
+            return [Fitness, Table]
+            {
+                Table->Build(
+                    Fitness->cbegin(),
+                    Fitness->cend(),
+                    [](auto x) noexcept { return 1 / x; });
+                KeepValue(Table->Size());
+            };
+        });
+
+    // Drawing a parent for mutation
+    suite.Add(
+        "AliasTable::Sample",
+        ParamGrid({{"population", {100, 1000, 10000}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Rng = std::make_shared<std::minstd_rand>(1);
+            std::vector<double> fitness(Param(params, "population"));
+            for(auto& x: fitness)
+                x = std::uniform_real_distribution<>{1, 100}(*Rng);
+            auto const Table = std::make_shared<AliasTable>();
+            Table->Build(
+                fitness.cbegin(),
+                fitness.cend(),
+                [](auto x) noexcept { return 1 / x; });
+            return [Table, Rng]
+            {
+                KeepValue(Table->Sample(*Rng));
+            };
+        });
+
+    // Drawing a parent for crossover
+    suite.Add(
+        "Tournament",
+        ParamGrid({
+            {"population", {100, 1000, 10000}},
+            {"group", {4}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Rng = std::make_shared<std::minstd_rand>(1);
+            auto const Fitness = std::make_shared<std::vector<double>>(
+                Param(params, "population"));
+            for(auto& fitness: *Fitness)
+                fitness = std::uniform_real_distribution<>{1, 100}(*Rng);
+            auto const Group = Param(params, "group");
+            return [Fitness, Rng, Group]
+            {
+                KeepValue(*Tournament(
+                    Fitness->cbegin(),
+                    Fitness->cend(),
+                    Group,
+                    *Rng,
+                    std::less<>{}));
+            };
+        });
+
+    // A step of a run from its start, the run starts over at its end
+    suite.Add(
+        "GPPalletDemandMinimisation::Step",
+        ParamGrid({
+            {"rows", {1000, 10000}},
+            {"columns", {Columns}},
+            {"population", {100, 1000}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Gp = std::make_shared<GPPalletDemandMinimisation>(
+                RandomPalletData(
+                    Param(params, "rows"),
+                    Param(params, "columns"),
+                    1),
+                Param(params, "population"));
+            Gp->Initialise();
+            return [Gp]
+            {
+                Gp->Step();
+                if(Gp->Terminate())
+                    Gp->Initialise();
+            };
+        });
+
+    suite.Run(1 < argc ? argv[1] : "", std::cout);
+}
+
+Expr RandomExpr(std::size_t nodes, std::size_t argCount, std::uint32_t seed)
+{
+    std::minstd_rand rng{seed};
+    ExprArena arena{};
+    return Expr{arena.View(arena.Write([&](ExprWriter& out)
+    {
+        WriteRandomExpr(out, rng, argCount, FullDepthWithin(nodes), 0.0);
+    }))};
+}
@@ -0,0 +1,196 @@
+// Fuzz the native code of CompiledExpr against the interpreter. Random
+// expressions heavy in division, over constants and columns which are often
+// exactly or nearly zero, are compiled and evaluated for every row count up
+// to a few blocks, odd ones included, and every row must match EvalExpr bit
+// for bit, or both be NaN. Every expression is evaluated again with other
+// constants in place of its own, as the constant tuning does. The optional
+// arguments are the number of expressions and the seed.
+#include "CS3910/GP.h"
+#include "CS3910/JIT.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+// Write a random expression of at most the depth, about a third of the
+// operators are divisions.
+void WriteFuzzExpr(
+    ExprWriter& out,
+    std::mt19937_64& rng,
+    std::size_t argCount,
+    std::size_t depth);
+
+// A value which is often zero, nearly zero or an extreme.
+double FuzzValue(std::mt19937_64& rng);
+
+// Whether two results agree bit for bit, any NaN agrees with any other.
+bool SameResult(double a, double b) noexcept;
+
+int main(int argc, char const** argv)
+{
+    // Configuration
+    constexpr std::size_t ArgCount = 3;
+    constexpr std::size_t MaxDepth = 6;
+    constexpr std::size_t MaxRows = 4 * internal::EvalBlockSize + 3;
+
+    auto const Iterations = 1 < argc ? std::stoull(argv[1]) : 10000ull;
+    auto const Seed = 2 < argc ? std::stoull(argv[2]) : 1ull;
+    if(!CompiledExpr::Available)
+    {
+        std::cout << "No native code on this platform, nothing to fuzz\n";
+        return 0;
+    }
+
+    std::mt19937_64 rng{Seed};
+    ExprArena arena{};
+    std::vector<double> columns{};
+    std::vector<double> out{};
+    std::vector<double> args(ArgCount);
+    std::vector<double> stack{};
+    std::vector<double> consts{};
+    std::size_t rowsChecked{};
+    for(std::size_t k{}; k != Iterations; ++k)
+    {
+        arena.Clear();
+        auto const Slice = arena.Write([&](ExprWriter& writer)
+        {
+            WriteFuzzExpr(writer, rng, ArgCount, MaxDepth);
+        });
+        auto const Function = Expr{arena.View(Slice)};
+        CompiledExpr const Compiled{Function};
+        auto const View = ExprView{Function};
+        stack.resize(internal::StackDepthExpr(
+            View.BeginCode(),
+            View.EndCode()));
+
+        // The columns are padded so that the stride is not the row count
+        auto const Rows = std::uniform_int_distribution<std::size_t>{
+            0,
+            MaxRows}(rng);
+        auto const Stride = Rows + std::uniform_int_distribution<std::size_t>{
+            0,
+            3}(rng);
+        columns.resize(ArgCount * Stride);
+        for(auto& x: columns)
+            x = FuzzValue(rng);
+        consts.resize(View.ConstCount());
+        for(auto& x: consts)
+            x = FuzzValue(rng);
+        auto const Replaced = ExprView{
+            View.BeginCode(),
+            View.BeginExtents(),
+            View.Count(),
+            consts.data(),
+            consts.size()};
+
+        for(auto const Checked: {View, Replaced})
+        {
+            out.assign(Rows, 0.0);
+            if(Checked.BeginConsts() == View.BeginConsts())
+                Compiled.Eval(columns.data(), Stride, Rows, out.data());
+            else
+                Compiled.Eval(
+                    columns.data(),
+                    Stride,
+                    Rows,
+                    out.data(),
+                    consts.data());
+
+            for(std::size_t i{}; i != Rows; ++i)
+            {
+                for(std::size_t j{}; j != ArgCount; ++j)
+                    args[j] = columns[j * Stride + i];
+                auto const Expected = internal::EvalExpr(
+                    Checked.BeginCode(),
+                    Checked.EndCode(),
+                    Checked.EndConsts(),
+                    args.data(),
+                    stack.data());
+                if(!SameResult(out[i], Expected))
+                {
+                    std::cout << std::setprecision(17)
+                        << "Mismatch on row " << i << " of " << Rows
+                        << " for " << Checked << ": compiled " << out[i]
+                        << ", interpreted " << Expected << " (seed "
+                        << Seed << ", expression " << k << ")\n";
+                    return 1;
+                }
+            }
+            rowsChecked += Rows;
+        }
+    }
+
+    std::cout << Iterations << " expressions, " << rowsChecked
+        << " rows matched\n";
+}
+
+void WriteFuzzExpr(
+    ExprWriter& out,
+    std::mt19937_64& rng,
+    std::size_t argCount,
+    std::size_t depth)
+{
+    using internal::OpCode;
+    auto const X = std::uniform_real_distribution<>{0, 1}(rng);
+    if(depth == 0 || X < 0.3)
+    {
+        if(X < 0.15)
+            out.PushConst(FuzzValue(rng));
+        else
+            out.PushArg(std::uniform_int_distribution<std::uint64_t>{
+                0,
+                argCount - 1}(rng));
+        return;
+    }
+
+    constexpr OpCode Ops[] = {
+        OpCode::Add,
+        OpCode::Sub,
+        OpCode::Mul,
+        OpCode::Div,
+        OpCode::Div};
+    out.PushOp(Ops[std::uniform_int_distribution<std::size_t>{0, 4}(rng)]);
+    WriteFuzzExpr(out, rng, argCount, depth - 1);
+    WriteFuzzExpr(out, rng, argCount, depth - 1);
+}
+
+double FuzzValue(std::mt19937_64& rng)
+{
+    constexpr double Specials[] = {
+        0.0,
+        -0.0,
+        std::numeric_limits<double>::denorm_min(),
+        -std::numeric_limits<double>::denorm_min(),
+        std::numeric_limits<double>::min(),
+        1e-300,
+        -1e-300,
+        1e-17,
+        1.0,
+        -1.0,
+        1e300,
+        -1e300};
+    constexpr auto SpecialCount = sizeof(Specials) / sizeof(*Specials);
+
+    auto const I = std::uniform_int_distribution<std::size_t>{
+        0,
+        2 * SpecialCount}(rng);
+    if(I < SpecialCount)
+        return Specials[I];
+    return std::uniform_real_distribution<>{-100, 100}(rng);
+}
+
+bool SameResult(double a, double b) noexcept
+{
+    if(std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b);
+
+    std::uint64_t bitsA, bitsB;
+    std::memcpy(&bitsA, &a, sizeof(a));
+    std::memcpy(&bitsB, &b, sizeof(b));
+    return bitsA == bitsB;
+}
@@ -1,328 +1,2460 @@
 #include "CS3910/Core.h"
+#include "CS3910/FitnessCache.h"
+#include "CS3910/Fidelity.h"
 #include "CS3910/Simulation.h"
 #include "CS3910/Pallets.h"
 #include "CS3910/GP.h"
+#include "CS3910/JIT.h"
+#include "CS3910/LinearGP.h"
+#include "CS3910/NodeOutputs.h"
+#include "CS3910/ParetoArchive.h"
+#include "CS3910/PSO.h"
+#include "CS3910/SpscQueue.h"
+#include "CS3910/SubtreeStore.h"
+#include "CS3910/Tiles.h"
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <execution>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
 
-double Estemate(PalletData& data, Expr const& expr);
+// Compiling an expression only pays off over many rows
+constexpr std::size_t MinCompiledRows = 1024;
+
+// Compile an expression to be evaluated over the data when the data has
+// enough rows for the compiling to pay off.
+std::optional<CompiledExpr> Compile(PalletData const& data, ExprView expr);
+
+double Estemate(PalletData& data, ExprView expr);
+
+double Estemate(PalletData& data, CompiledExpr const& expr);
+
+// Score a compiled expression with other constants in place of its own.
+double Estemate(
+    PalletData& data,
+    CompiledExpr const& expr,
+    double const* consts);
+
+double Estemate(
+    PalletData& data,
+    SubtreeStore& store,
+    SubtreeStore::NodeId root);
+
+double Estemate(
+    PalletData& data,
+    NodeOutputs const& parent,
+    std::size_t id,
+    ExprView replacement);
+
+double Estemate(PalletData& data, LinearProgram const& program);
+
+double Estemate(PalletData& data, double const* estemates);
+
+// The sum of the absolute errors of the estemates of count rows from the
+// first, weighted if the rows are.
+double AbsoluteError(
+    PalletData const& data,
+    double const* estemates,
+    std::size_t first,
+    std::size_t count);
+
+template<typename RngT>
+void WriteRandomExpr(
+    ExprWriter& out,
+    RngT& rng,
+    std::uint64_t argCount,
+    std::size_t maxDepth,
+    double terminalPropability);
 
 template<typename RngT>
-Expr GenerateRandomExpr(
+void WriteRampedExpr(
+    ExprWriter& out,
     RngT& rng,
     std::uint64_t argCount,
-    std::size_t maxDepth);
+    std::size_t minDepth,
+    std::size_t maxDepth,
+    double terminalPropability);
+
+// The expression whose constants are tuned by GPConstantOptimisation, and
+// the same expression compiled once for all of the particles, if it is.
+struct GPConstantTuning
+{
+    PalletData* data;
+    ExprView function;
+    CompiledExpr const* compiled;
+    std::minstd_rand::result_type seed;
+};
+
+// A control policy for BasicPSO tuning the constants of an expression to the
+// data without changing its shape. The position of a particle is the
+// constants of the expression in order.
+class GPConstantOptimisation
+{
+public:
+    constexpr static auto StartingFitness
+        = std::numeric_limits<double>::infinity();
+
+    explicit GPConstantOptimisation(GPConstantTuning const& tuning);
+
+    void Init(Particles& particles);
+
+    void Update(
+        Particles& particles,
+        double* globalBestPosition,
+        PSOParameters const& params);
+
+    double Evaluate(typename Particles::Individual const& particle);
+
+    std::size_t Dimension();
+
+    constexpr static bool Compare(double a, double b)
+    {
+        return a < b;
+    }
+private:
+    // Configuration
+    // The first particle starts on the constants and the rest are scattered
+    // around them in proportion to their size
+    constexpr static double Spread = 0.1;
+
+    GPConstantTuning tuning_;
+
+    std::vector<std::minstd_rand> rngs_;
+};
+
+using GPConstantMinimisation = BasicPSO<
+    GPConstantTuning,
+    GPConstantOptimisation>;
+
+// Keeps an archive of the fittest individuals for their size, see
+// ParetoArchive, and completes with the whole front.
+class GPPalletDemandMinimisation final
+{
+public:
+    using Result = ParetoArchive::Entry;
+
+    // Configuration, shared with GPSteadyStatePalletDemandMinimisation
+    constexpr static std::size_t MaxExpressionSize = 1000;
+    constexpr static std::size_t TournamentSize = 4;
+    constexpr static std::size_t MinInitialDepth = 1;
+    constexpr static std::size_t InitialDepth = 2;
+    constexpr static std::size_t MutationDepth = 2;
+    constexpr static std::size_t MaxIteration = 1000;
+    constexpr static std::size_t FitnessCacheSize = 1 << 16;
+    // The chance of a grown tree ending in a terminal before its depth
+    constexpr static double GrowTerminalPropability = 0.3;
+    constexpr static double MutationPropability = 0.05;
+    constexpr static double ReplicationPropabillity = 0.15;
+    constexpr static double CrossoverProbabillity = 1 - (MutationPropability
+        + ReplicationPropabillity);
+
+    explicit GPPalletDemandMinimisation(
+        PalletData historicalData,
+        std::size_t populationSize)
+        noexcept;
+
+    void Initialise();
+
+    void Step();
+
+    bool Terminate() noexcept;
+
+    // The front of the archive, the smallest first and the fittest last.
+    std::vector<Result> Complete();
+
+    FitnessCache const& Cache() const noexcept;
+
+    // Copy the best individuals of the population, the best first.
+    std::vector<Result> Elites(std::size_t count) const;
+
+    // Replace the worst individual of the population with a migrant. The
+    // fitness of the migrant is of the data of where it came from, so it is
+    // looked up or evaluated again on the data of this population.
+    void Immigrate(Result const& migrant);
+private:
+    // An individual is a slice of the population arena of the brood which
+    // bred it
+    struct Individual
+    {
+        ExprArena::Slice function;
+        double fitness;
+        std::size_t brood;
+        // The hash of the function, see ExprView::Hash, set once it is in
+        // the population arena so that the caches do not hash it again
+        std::uint64_t hash{};
+    };
+
+    // How an offspring was bred from a parent whose node outputs are kept,
+    // so that only the replaced subtree and its ancestors are evaluated
+    struct Lineage
+    {
+        // Null when the outputs of the parent are not kept
+        NodeOutputs const* parent;
+        // The node of the parent which was replaced
+        std::size_t node;
+        // The offspring as bred, before simplification
+        ExprArena::Slice bred;
+    };
+
+    // A share of the offspring of a generation, bred by a single task with
+    // its own random numbers. The offspring are bred from the population
+    // into the offspring arena and simplified back into the population
+    // arena once all broods are done with the parents, so the two swap
+    // roles within every generation and keep their memory.
+    struct Brood
+    {
+        std::minstd_rand rng{};
+        ExprArena population{};
+        ExprArena offspring{};
+        std::vector<Individual> individuals{};
+        // Parallel to the individuals
+        std::vector<Lineage> lineages{};
+    };
+
+    ExprView View(Individual const& c) const noexcept;
+
+    // Breed the offspring of the brood with the id.
+    void Breed(Brood& brood, std::size_t id, std::size_t count);
+
+    void Settle(Brood& brood);
+
+    // The indices of the best individuals of the population, the best
+    // first.
+    std::vector<std::size_t> Best(std::size_t count) const;
+
+    // Keep the node outputs of the best individuals of the population,
+    // reusing those of the last generation which survived.
+    void KeepNodeOutputs();
+
+    // Reject offspring of unknown fitness without evaluating them when the
+    // range of their values on the data, see ExprView::Range, is a single
+    // infinity, as from a division by exactly zero or a certain overflow,
+    // or when its least error shows that they could never enter the
+    // archive. An offspring which only might divide by zero is evaluated.
+    // The rejected get the worst fitness.
+    void Screen(PalletData const& data);
+
+    // Evaluate the offspring of unknown fitness on the data and cache their
+    // fitness. The work is split into tiles of rows, see SplitTiles, except
+    // that an individual evaluated through the subtree store, at its root
+    // in the roots, is evaluated over all rows at once.
+    void EvaluateOffspring(
+        PalletData& data,
+        FitnessCache& cache,
+        std::vector<SubtreeStore::NodeId> const& roots,
+        bool shareSubtrees);
+
+    // Cull offspring of unknown fitness larger than the average, at random,
+    // until evaluating the rest on the rows fits in the budget, see
+    // EvaluationBudget. The culled get the worst fitness.
+    void Cull(std::size_t rows);
+
+    // Tune the constants of the best individuals of the population in
+    // place with a swarm, see GPConstantOptimisation.
+    void TuneConstants(PalletData& data);
+
+    // The data to evaluate the generation on, the historical data or a
+    // stand-in for it early in a run with much data, see Fidelity.
+    PalletData& EvaluationData();
+
+    // The cache of the fitness on the data, which is either the historical
+    // data or the current stand-in.
+    FitnessCache& CacheOf(PalletData const& data) noexcept;
+
+    // Offer the best of a generation evaluated on a stand-in to the
+    // archive, evaluating them on the historical data.
+    void ConfirmBest();
+
+    // Configuration
+    // The number of offspring bred by a task, which does not depend on the
+    // number of threads so that a seed always gives the same run
+    constexpr static std::size_t BroodSize = 64;
+    // Evaluate through a store of the subtrees shared by the offspring of a
+    // generation when there are enough rows for the bookkeeping to pay off.
+    // The store is cleared whenever it grows past MaxSharedSubtrees nodes.
+    constexpr static std::size_t MinSharedRows = 1024;
+    constexpr static std::size_t SharedSubtreeBudget = std::size_t{256} << 20;
+    constexpr static std::size_t MaxSharedSubtrees = 1 << 20;
+    // The node outputs of the best individuals are kept, those which need
+    // more than their share of the budget are not
+    constexpr static std::size_t IncrementalElites = 8;
+    constexpr static std::size_t NodeOutputBudget = std::size_t{256} << 20;
+    // Every MemeticInterval generations the constants of the MemeticCount
+    // best individuals are tuned by a small swarm
+    constexpr static std::size_t MemeticInterval = 10;
+    constexpr static std::size_t MemeticCount = 2;
+    constexpr static std::size_t TuningParticles = 10;
+    constexpr static std::size_t TuningIterations = 20;
+    // With at least MinMultiFidelityRows rows the early generations are
+    // evaluated on a stand-in for the data. The fidelity rises from
+    // MinFidelity to all of the rows over FidelityRamp generations, below
+    // CoresetFidelity the coreset is used and above it subsamples of that
+    // fraction of the rows. The ConfirmCount best of such a generation are
+    // evaluated on all of the rows. A subsample is only drawn again once
+    // the fidelity has doubled, so that its fitness can be cached.
+    constexpr static std::size_t MinMultiFidelityRows = 4096;
+    constexpr static std::size_t CoresetSize = 256;
+    constexpr static double MinFidelity = 0.01;
+    constexpr static double CoresetFidelity = 0.05;
+    constexpr static std::size_t FidelityRamp = MaxIteration / 2;
+    constexpr static std::size_t ConfirmCount = 2;
+    // Evaluating a generation may cost at most EvaluationBudget nodes
+    // times rows, beyond that the larger offspring are culled unevaluated
+    // (Tarpeian bloat control)
+    constexpr static std::size_t EvaluationBudget = std::size_t{1} << 28;
+
+    std::vector<Individual> population_;
+
+    std::vector<Individual> offspring_{};
+
+    std::vector<Brood> broods_{};
+
+    // Parallel to the offspring
+    std::vector<Lineage> lineages_{};
+
+    std::vector<std::unique_ptr<NodeOutputs const>> nodeOutputs_{};
+
+    // The kept node outputs of every individual of the population, if any
+    std::vector<NodeOutputs const*> outputsOf_{};
+
+    // The estemates of the tile each evaluating worker is on, kept from one
+    // generation to the next
+    std::vector<std::vector<double>> tileEstemates_{};
+
+    // Fitness proportionate selection of the population
+    AliasTable selection_{};
+
+    PalletData historicalData_;
+
+    std::optional<PalletData> coreset_{};
+
+    std::optional<PalletData> sample_{};
+
+    FitnessCache cache_{FitnessCacheSize};
+
+    FitnessCache standInCache_{FitnessCacheSize};
+
+    SubtreeStore store_{SharedSubtreeBudget};
+
+    std::minstd_rand rng_{};
+
+    // The individuals evaluated on the historical data which are the
+    // fittest for their size
+    ParetoArchive archive_{};
+
+    std::size_t iteration_{};
+
+    std::size_t PopulationSize_;
+};
+
+enum class MigrationTopology
+{
+    // Every island sends its migrants to the next
+    Ring,
+    // Every island sends its migrants to any other island
+    Random
+};
+
+// Evolves a GP population on each of several islands, with their own random
+// numbers, arenas and caches. A step is a generation of every island, the
+// islands evolving in parallel. Every MigrationInterval generations the
+// elites of an island migrate through a lock-free queue to another island,
+// which takes them in after its next generation. A full queue drops
+// migrants.
+class GPIslandPalletDemandMinimisation final
+{
+public:
+    using Result = GPPalletDemandMinimisation::Result;
+
+    explicit GPIslandPalletDemandMinimisation(
+        PalletData historicalData,
+        std::size_t islandCount,
+        std::size_t populationSize,
+        MigrationTopology topology);
+
+    void Initialise();
+
+    // Evolve every island by a generation.
+    void Step();
+
+    bool Terminate() noexcept;
+
+    // The front of the archives of all islands together.
+    std::vector<Result> Complete();
+private:
+    using Queue = SpscQueue<Result>;
+
+    // Configuration
+    constexpr static std::size_t MigrationInterval = 10;
+    constexpr static std::size_t MigrantCount = 2;
+    constexpr static std::size_t MigrationQueueSize = 8;
+
+    // Evolve an island by a generation and exchange its migrants.
+    void Evolve(std::size_t island);
+
+    // There is a queue from every island to every other, so that each has
+    // a single producer and a single consumer.
+    Queue& QueueOf(std::size_t from, std::size_t to) noexcept;
+
+    std::deque<GPPalletDemandMinimisation> islands_{};
+
+    std::vector<std::unique_ptr<Queue>> queues_{};
+
+    // Picks the destinations of the migrants of each island
+    std::vector<std::minstd_rand> rngs_{};
+
+    MigrationTopology topology_;
+
+    std::size_t generation_{};
+};
+
+// Evolves a single population without generations. Breeding threads keep
+// producing offspring from the current population while evaluating threads
+// score them, each breeder feeding one evaluator through a lock-free queue,
+// and a scored offspring replaces the loser of a tournament if it is
+// fitter. Every member of the population is replaced on its own, so no
+// thread waits for a generation to finish.
+//
+// The threads run from Initialise until the run terminates. A step lets a
+// generation's worth of offspring, as many as the population, be bred and
+// returns once the offspring of the step before are evaluated, so the
+// breeders keep a step ahead and the pipeline never drains. Between steps
+// the threads sleep once they run out of work.
+class GPSteadyStatePalletDemandMinimisation final
+{
+public:
+    using Result = GPPalletDemandMinimisation::Result;
+
+    explicit GPSteadyStatePalletDemandMinimisation(
+        PalletData historicalData,
+        std::size_t populationSize,
+        std::size_t laneCount);
+
+    GPSteadyStatePalletDemandMinimisation(
+        GPSteadyStatePalletDemandMinimisation const&) = delete;
+
+    GPSteadyStatePalletDemandMinimisation& operator=(
+        GPSteadyStatePalletDemandMinimisation const&) = delete;
+
+    ~GPSteadyStatePalletDemandMinimisation();
+
+    void Initialise();
+
+    // Breed and evaluate a generation's worth of offspring.
+    void Step();
+
+    // Stops the threads once the run is over.
+    bool Terminate() noexcept;
+
+    // The front of the accepted offspring, see ParetoArchive, the smallest
+    // first and the fittest last.
+    std::vector<Result> Complete();
+
+    FitnessCache const& Cache() const noexcept;
+private:
+    // A member of the population, the expression is shared with the
+    // breeders which picked it as a parent
+    struct Slot
+    {
+        std::mutex mutex{};
+        std::shared_ptr<Expr const> function{};
+        double fitness{};
+    };
+
+    // A breeder and the evaluator it feeds, the breeder closes the queue
+    // once it is done
+    struct Lane
+    {
+        explicit Lane(std::size_t size)
+            : queue{size}
+        {
+        }
+
+        SpscQueue<Expr> queue;
+    };
+
+    // Configuration, see GPPalletDemandMinimisation
+    using Generational = GPPalletDemandMinimisation;
+    constexpr static auto MaxExpressionSize = Generational::MaxExpressionSize;
+    constexpr static auto TournamentSize = Generational::TournamentSize;
+    constexpr static auto MinInitialDepth = Generational::MinInitialDepth;
+    constexpr static auto InitialDepth = Generational::InitialDepth;
+    constexpr static auto MutationDepth = Generational::MutationDepth;
+    constexpr static auto MaxIteration = Generational::MaxIteration;
+    constexpr static auto FitnessCacheSize = Generational::FitnessCacheSize;
+    constexpr static auto GrowTerminalPropability
+        = Generational::GrowTerminalPropability;
+    constexpr static auto MutationPropability
+        = Generational::MutationPropability;
+    constexpr static auto ReplicationPropabillity
+        = Generational::ReplicationPropabillity;
+    constexpr static auto CrossoverProbabillity
+        = Generational::CrossoverProbabillity;
+    constexpr static std::size_t LaneSize = 64;
+
+    // Start the breeders and evaluators.
+    void Start();
+
+    // Stop and join the threads, dropping the offspring not yet evaluated.
+    void Stop() noexcept;
+
+    // Wait until count more offspring may be bred in the step, returns
+    // false once the threads are stopping.
+    bool Reserve(std::size_t count);
+
+    // Stop the threads on an error, which the next step rethrows.
+    void Fail(std::exception_ptr error);
+
+    void Breed(Lane& lane, std::minstd_rand::result_type seed);
+
+    void Evaluate(Lane& lane, std::minstd_rand::result_type seed);
+
+    // Hold a tournament in the population, returning the winner or loser.
+    template<typename RngT>
+    Slot& Tournament(RngT& rng, bool loser);
+
+    std::shared_ptr<Expr const> Parent(Slot& slot);
+
+    double Fitness(Expr const& function);
+
+    std::unique_ptr<Slot[]> population_;
+
+    PalletData historicalData_;
+
+    FitnessCache cache_{FitnessCacheSize};
+
+    std::vector<std::unique_ptr<Lane>> lanes_{};
+
+    std::vector<std::thread> threads_{};
+
+    // The progress of the run, guarded by the mutex. The breeders wait for
+    // the quota to rise and a step for the offspring to be evaluated.
+    std::mutex progressMutex_{};
+
+    std::condition_variable quotaRaised_{};
+
+    std::condition_variable evaluated_{};
+
+    std::size_t bredCount_{};
+
+    std::size_t evaluatedCount_{};
+
+    std::size_t quota_{};
+
+    std::size_t target_{};
+
+    std::exception_ptr error_{};
+
+    std::atomic<bool> stopping_{};
+
+    // The initial population and the offspring which replaced a member of
+    // the population, guarded by the mutex
+    std::mutex archiveMutex_{};
+
+    ParetoArchive archive_{};
+
+    std::size_t iteration_{};
+
+    std::size_t const PopulationSize_;
+
+    std::size_t const LaneCount_;
+};
+
+// Linear genetic programming, the individuals are register programs (see
+// LinearProgram) bred by array operations. Crossover swaps a segment of one
+// program with a segment of another and mutation changes a field of an
+// instruction or a constant, or inserts or removes an instruction. The
+// introns are removed before a program is evaluated.
+class LinearGPPalletDemandMinimisation final
+{
+public:
+    struct Result
+    {
+        LinearProgram program;
+        double fitness;
+    };
+
+    explicit LinearGPPalletDemandMinimisation(
+        PalletData historicalData,
+        std::size_t populationSize)
+        noexcept;
+
+    void Initialise();
+
+    void Step();
+
+    bool Terminate() noexcept;
+
+    Result Complete();
+private:
+    struct Individual
+    {
+        LinearProgram program;
+        double fitness;
+    };
+
+    internal::LinearInstr RandomInstr();
+
+    LinearProgram RandomProgram();
+
+    void Mutate(LinearProgram& program);
+
+    void Crossover(LinearProgram& a, LinearProgram& b);
+
+    // Configuration
+    constexpr static std::size_t RegisterCount = 8;
+    constexpr static std::size_t ConstCount = 8;
+    constexpr static std::size_t MinInitialLength = 2;
+    constexpr static std::size_t MaxInitialLength = 16;
+    constexpr static std::size_t MaxLength = 256;
+    constexpr static std::size_t TournamentSize = 4;
+    constexpr static std::size_t MaxIteration = 1000;
+    // A mutation either changes a single field or constant, or inserts or
+    // removes an instruction. A constant moves in proportion to its size.
+    constexpr static double MicroMutationPropability = 0.5;
+    constexpr static double ConstSpread = 0.1;
+    constexpr static double MutationPropability = 0.3;
+    constexpr static double ReplicationPropabillity = 0.1;
+    constexpr static double CrossoverProbabillity = 1 - (MutationPropability
+        + ReplicationPropabillity);
+
+    std::vector<Individual> population_{};
+
+    std::vector<Individual> offspring_{};
+
+    PalletData historicalData_;
+
+    std::minstd_rand rng_{};
+
+    double bestFitness_ = std::numeric_limits<double>::infinity();
+
+    LinearProgram bestProgram_{};
+
+    std::size_t iteration_{};
+
+    std::size_t PopulationSize_;
+};
+
+// The benchmarks include this file without its entry point
+#ifndef CS3910_NO_MAIN
+int main(int argc, char const** argv) try
+{
+    auto dataSet = ReadPalletData(argc, argv, std::cout);
+
+    auto const PopulationSize = 100;
+
+    // An optional third argument picks the island model, migrating around
+    // a ring or to random islands
+    if(3 < argc && (std::string{argv[3]} == "islands"
+        || std::string{argv[3]} == "islands-random"))
+    {
+        auto const Topology = std::string{argv[3]} == "islands"
+            ? MigrationTopology::Ring
+            : MigrationTopology::Random;
+        GPIslandPalletDemandMinimisation islands{
+            dataSet.trainingData,
+            std::max(2u, std::thread::hardware_concurrency()),
+            PopulationSize,
+            Topology};
+        for(auto const& result: Simulate(islands))
+            std::cout
+                << Estemate(dataSet.testingData, result.function) << "| "
+                << result.function << "\n";
+        return 0;
+    }
+
+    // Or the steady-state engine, with a breeder and an evaluator for
+    // every pair of cores
+    if(3 < argc && std::string{argv[3]} == "steady")
+    {
+        GPSteadyStatePalletDemandMinimisation steady{
+            dataSet.trainingData,
+            PopulationSize,
+            std::max(1u, std::thread::hardware_concurrency() / 2)};
+        for(auto const& result: Simulate(steady))
+            std::cout
+                << Estemate(dataSet.testingData, result.function) << "| "
+                << result.function << "\n";
+        std::cout << "Fitness cache hit rate: "
+            << steady.Cache().HitRate() << '\n';
+        return 0;
+    }
+    // Or the linear GP
+    if(3 < argc && std::string{argv[3]} == "linear")
+    {
+        LinearGPPalletDemandMinimisation linear{
+            dataSet.trainingData,
+            PopulationSize};
+        auto result = Simulate(linear);
+
+        std::cout
+            << Estemate(dataSet.testingData, result.program) << "|\n"
+            << result.program;
+        return 0;
+    }
+
+    // The front, the smallest expression first and the fittest last
+    GPPalletDemandMinimisation gp{ dataSet.trainingData, PopulationSize };
+    for(auto const& result: Simulate(gp))
+        std::cout
+            << Estemate(dataSet.testingData, result.function) << "| "
+            << result.function << "\n";
+    std::cout << "Fitness cache hit rate: " << gp.Cache().HitRate() << '\n';
+}
+catch (InvalidFileName& e)
+{
+    std::cout << "Cannot read file: " << e.what();
+}
+catch (std::exception& e)
+{
+    std::cout << e.what();
+}
+#endif // !CS3910_NO_MAIN
+
+GPPalletDemandMinimisation::GPPalletDemandMinimisation(
+    PalletData historicalData,
+    std::size_t populationSize)
+    noexcept
+    : population_{}
+    , historicalData_{std::move(historicalData)}
+    , PopulationSize_{populationSize}
+{
+}
+
+void GPPalletDemandMinimisation::Initialise()
+{
+    rng_.seed(std::random_device{}());
+    cache_.Clear();
+    store_.Clear();
+    nodeOutputs_.clear();
+    standInCache_.Clear();
+    coreset_.reset();
+    sample_.reset();
+    if(MinMultiFidelityRows <= historicalData_.RowCount())
+        coreset_ = Coreset(historicalData_, CoresetSize, rng_);
+    broods_.resize((PopulationSize_ + BroodSize - 1) / BroodSize);
+    for(auto& brood: broods_)
+        brood.rng.seed(rng_());
+
+    // Ramped half-and-half
+    std::for_each(
+        std::execution::par,
+        broods_.begin(),
+        broods_.end(),
+        [&](auto& brood)
+        {
+            auto const Id = static_cast<std::size_t>(&brood - broods_.data());
+            auto const Count = std::min(
+                BroodSize,
+                PopulationSize_ - Id * BroodSize);
+            brood.population.Clear();
+            brood.individuals.clear();
+            std::generate_n(
+                std::back_inserter(brood.individuals),
+                Count,
+                [&]()
+                {
+                    return Individual{
+                        brood.population.Write([&](ExprWriter& out)
+                        {
+                            WriteRampedExpr(
+                                out,
+                                brood.rng,
+                                historicalData_.DataCount(),
+                                MinInitialDepth,
+                                InitialDepth,
+                                GrowTerminalPropability);
+                        }),
+                        0.0,
+                        Id};
+                });
+        });
+
+    population_.clear();
+    for(auto& brood: broods_)
+        population_.insert(
+            population_.end(),
+            brood.individuals.begin(),
+            brood.individuals.end());
+
+    auto& data = EvaluationData();
+    std::for_each(
+        std::execution::par,
+        population_.begin(),
+        population_.end(),
+        [&](auto& c)
+        {
+            auto const Function = View(c);
+            auto const Compiled = Compile(data, Function);
+            c.hash = Function.Hash();
+            c.fitness = Compiled
+                ? Estemate(data, *Compiled)
+                : Estemate(data, Function);
+            CacheOf(data).Insert(View(c), c.hash, c.fitness);
+        });
+}
+
+void GPPalletDemandMinimisation::Step()
+{
+    auto const ByFitness = [](auto const& a, auto const& b) noexcept
+    {
+        return a.fitness < b.fitness;
+    };
+
+    // The kept outputs and the subtree store are over the historical data
+    // only
+    auto& data = EvaluationData();
+    auto& cache = CacheOf(data);
+    auto const Full = &data == &historicalData_;
+    if(Full)
+        KeepNodeOutputs();
+    else
+    {
+        nodeOutputs_.clear();
+        outputsOf_.assign(population_.size(), nullptr);
+    }
+
+    // Breed in parallel, every brood reads the parents but only writes its
+    // own arenas
+    selection_.Build(
+        population_.cbegin(),
+        population_.cend(),
+        [](auto const& c) noexcept { return 1 / c.fitness; });
+    for(auto& brood: broods_)
+        brood.rng.seed(rng_());
+    std::for_each(
+        std::execution::par,
+        broods_.begin(),
+        broods_.end(),
+        [&](auto& brood)
+        {
+            auto const Id = static_cast<std::size_t>(&brood - broods_.data());
+            Breed(brood, Id, std::min(
+                BroodSize,
+                population_.size() - Id * BroodSize));
+        });
+
+    // The parents are no longer needed
+    std::for_each(
+        std::execution::par,
+        broods_.begin(),
+        broods_.end(),
+        [&](auto& brood) { Settle(brood); });
+
+    offspring_.clear();
+    lineages_.clear();
+    for(auto& brood: broods_)
+    {
+        offspring_.insert(
+            offspring_.end(),
+            brood.individuals.begin(),
+            brood.individuals.end());
+        lineages_.insert(
+            lineages_.end(),
+            brood.lineages.begin(),
+            brood.lineages.end());
+    }
+
+    // Look up the known individuals, the unknown fitness is NaN
+    std::for_each(
+        std::execution::par,
+        offspring_.begin(),
+        offspring_.end(),
+        [&](auto& c)
+        {
+            c.fitness = cache.Find(View(c), c.hash).value_or(
+                std::numeric_limits<double>::quiet_NaN());
+        });
+    Screen(data);
+    Cull(data.RowCount());
+
+    // Share the subtrees of the individuals which need evaluating
+    std::vector<SubtreeStore::NodeId> roots(offspring_.size());
+    auto const ShareSubtrees = Full
+        && MinSharedRows <= historicalData_.RowCount();
+    if(ShareSubtrees)
+    {
+        if(MaxSharedSubtrees < store_.NodeCount())
+            store_.Clear();
+        store_.NewGeneration();
+        for(std::size_t i{}; i != offspring_.size(); ++i)
+            if(std::isnan(offspring_[i].fitness)
+                && lineages_[i].parent == nullptr)
+                roots[i] = store_.Insert(View(offspring_[i]));
+        store_.Prune();
+    }
+
+    // Evaluate all the unknown individuals
+    EvaluateOffspring(data, cache, roots, ShareSubtrees);
+
+
+    // Fit the next generation
+    if(population_.size() < offspring_.size())
+    {
+        std::nth_element(
+            offspring_.begin(),
+            offspring_.begin() + population_.size(),
+            offspring_.end(),
+            ByFitness);
+        offspring_.resize(population_.size());
+    }
+
+    // Next generation
+    population_.swap(offspring_);
+
+    if(iteration_ % MemeticInterval == 0)
+        TuneConstants(data);
+
+    if(!Full)
+    {
+        ConfirmBest();
+        return;
+    }
+
+    // Offer the population to the archive, only those kept are copied
+    for(auto const& c: population_)
+    {
+        // Uncomment this to see the development... Useful for debugging!
+        //if(archive_.Accepts(c.fitness, View(c).Count()))
+        //    std::cout << ">>> " << iteration_
+        //        << ": " << c.fitness
+        //        << " [" << View(c) << "]\n";
+        archive_.Insert(View(c), c.fitness);
+    }
+}
+
+bool GPPalletDemandMinimisation::Terminate() noexcept
+{
+    return MaxIteration < ++iteration_;
+}
+
+std::vector<GPPalletDemandMinimisation::Result>
+GPPalletDemandMinimisation::Complete()
+{
+    // The initial population and the migrants may not be simplified
+    ParetoArchive front{};
+    for(auto const& entry: archive_.Front())
+        front.Insert(entry.function.Simplify(), entry.fitness);
+    return front.Front();
+}
+
+FitnessCache const& GPPalletDemandMinimisation::Cache() const noexcept
+{
+    return cache_;
+}
+
+std::vector<GPPalletDemandMinimisation::Result>
+GPPalletDemandMinimisation::Elites(std::size_t count) const
+{
+    std::vector<Individual> best(std::min(count, population_.size()));
+    std::partial_sort_copy(
+        population_.cbegin(),
+        population_.cend(),
+        best.begin(),
+        best.end(),
+        [](auto const& a, auto const& b) noexcept
+        {
+            return a.fitness < b.fitness;
+        });
+
+    std::vector<Result> elites{};
+    for(auto const& c: best)
+        elites.push_back(Result{Expr{View(c)}, c.fitness});
+    return elites;
+}
+
+void GPPalletDemandMinimisation::Immigrate(Result const& migrant)
+{
+    auto worst = std::max_element(
+        population_.begin(),
+        population_.end(),
+        [](auto const& a, auto const& b) noexcept
+        {
+            return a.fitness < b.fitness;
+        });
+
+    // The population arenas are not in use between generations
+    worst->function = broods_[worst->brood].population.Append(
+        migrant.function);
+    worst->hash = View(*worst).Hash();
+
+    // The sender may have been evaluating on a stand-in of its own
+    auto& data = EvaluationData();
+    auto& cache = CacheOf(data);
+    auto const Function = View(*worst);
+    if(auto const Known = cache.Find(Function, worst->hash))
+        worst->fitness = *Known;
+    else
+    {
+        auto const Compiled = Compile(data, Function);
+        worst->fitness = Compiled
+            ? Estemate(data, *Compiled)
+            : Estemate(data, Function);
+        cache.Insert(Function, worst->hash, worst->fitness);
+    }
+
+    if(&data == &historicalData_)
+        archive_.Insert(Function, worst->fitness);
+}
+
+ExprView GPPalletDemandMinimisation::View(Individual const& c) const noexcept
+{
+    return broods_[c.brood].population.View(c.function);
+}
+
+void GPPalletDemandMinimisation::Breed(
+    Brood& brood,
+    std::size_t id,
+    std::size_t count)
+{
+    auto const ByFitness = [](auto const& a, auto const& b) noexcept
+    {
+        return a.fitness < b.fitness;
+    };
+
+    auto& rng = brood.rng;
+    brood.offspring.Clear();
+    brood.individuals.clear();
+    brood.lineages.clear();
+    while(brood.individuals.size() < count)
+    {
+        auto const Total = MutationPropability + ReplicationPropabillity
+            + CrossoverProbabillity;
+        auto const X = std::uniform_real_distribution<>{0, Total }(rng);
+        if(X < MutationPropability)
+        {
+            // Select and mutate
+            auto const I = selection_.Sample(rng);
+
+            // A single terminal left over from simplification is replaced
+            // whole. The mutation is no deeper than fits in place of the
+            // node.
+            auto const Parent = View(population_[I]);
+            auto const Id = DepthFairNode(Parent, rng);
+            auto const Room = MaxExpressionSize
+                - (Parent.Count() - Parent.BeginExtents()[Id].size);
+
+            // The mutation is generated in place of the node
+            auto const Child = brood.offspring.SpliceWrite(
+                Parent,
+                Id,
+                [&](ExprWriter& out)
+                {
+                    WriteRandomExpr(
+                        out,
+                        rng,
+                        historicalData_.DataCount(),
+                        std::min(MutationDepth, FullDepthWithin(Room)),
+                        0.0);
+                });
+            brood.individuals.push_back(Individual{Child, 0.0, id});
+            brood.lineages.push_back(Lineage{outputsOf_[I], Id, Child});
+        }
+        else if(X < MutationPropability + ReplicationPropabillity)
+        {
+            // Select and replicate
+            auto it = population_.cbegin() + selection_.Sample(rng);
+            auto const Child = brood.offspring.Append(View(*it));
+            brood.individuals.push_back(Individual{Child, 0.0, id});
+            brood.lineages.push_back(Lineage{nullptr, 0, Child});
+        }
+        else
+        {
+            // Select and crossover
+            // Find the first parent using a tornament
+            auto const ParentA = Tournament(
+                population_.cbegin(),
+                population_.cend(),
+                TournamentSize,
+                rng,
+                ByFitness);
+
+            // Find the second parent using a tornament of the others, which
+            // the first parent also has to beat. When it does, it mates with
+            // the first member of the group, the challenger, so the best
+            // individual does not mate with itself.
+            auto const Challenger = Tournament(
+                population_.cbegin(),
+                population_.cend(),
+                1,
+                rng,
+                ByFitness,
+                {ParentA});
+            auto parentB = Challenger;
+            if(1 < TournamentSize && 2 < population_.size())
+                if(auto const It = Tournament(
+                        population_.cbegin(),
+                        population_.cend(),
+                        TournamentSize - 1,
+                        rng,
+                        ByFitness,
+                        {ParentA, Challenger});
+                    ByFitness(*It, *parentB))
+                    parentB = It;
+            if(!ByFitness(*parentB, *ParentA))
+                parentB = Challenger;
+
+            // Swap a size-fair pair of subtrees, or copy the parents when
+            // there is none. The replaced nodes are kept for the
+            // incremental evaluation.
+            auto const A = View(*ParentA);
+            auto const B = View(*parentB);
+            auto const [IdA, IdB] = CrossoverNodes(
+                A,
+                B,
+                MaxExpressionSize,
+                rng);
+            auto const OutputsOf = [&](auto it) noexcept
+            {
+                return outputsOf_[it - population_.cbegin()];
+            };
+            if(IdA == A.Count())
+            {
+                auto const ChildA = brood.offspring.Append(A);
+                auto const ChildB = brood.offspring.Append(B);
+                brood.individuals.push_back(Individual{ChildA, 0.0, id});
+                brood.individuals.push_back(Individual{ChildB, 0.0, id});
+                brood.lineages.push_back(Lineage{nullptr, 0, ChildA});
+                brood.lineages.push_back(Lineage{nullptr, 0, ChildB});
+                continue;
+            }
+
+            auto const ChildA = brood.offspring.Splice(A, IdA, B.SubExpr(IdB));
+            auto const ChildB = brood.offspring.Splice(B, IdB, A.SubExpr(IdA));
+            brood.individuals.push_back(Individual{ChildA, 0.0, id});
+            brood.individuals.push_back(Individual{ChildB, 0.0, id});
+            brood.lineages.push_back(Lineage{OutputsOf(ParentA), IdA, ChildA});
+            brood.lineages.push_back(Lineage{OutputsOf(parentB), IdB, ChildB});
+        }
+    }
+}
+
+void GPPalletDemandMinimisation::Settle(Brood& brood)
+{
+    // Simplify the offspring back into the population arena
+    brood.population.Clear();
+    for(auto& c: brood.individuals)
+    {
+        // The operators never breed an offspring which is too large
+        assert(c.function.count <= MaxExpressionSize && "Offspring too large");
+        c.function = brood.population.AppendSimplified(
+            brood.offspring.View(c.function));
+        c.hash = brood.population.View(c.function).Hash();
+    }
+}
+
+std::vector<std::size_t> GPPalletDemandMinimisation::Best(
+    std::size_t count) const
+{
+    std::vector<std::size_t> best(population_.size());
+    std::iota(best.begin(), best.end(), std::size_t{});
+    count = std::min(count, best.size());
+    std::partial_sort(
+        best.begin(),
+        best.begin() + count,
+        best.end(),
+        [&](auto a, auto b) noexcept
+        {
+            return population_[a].fitness < population_[b].fitness;
+        });
+    best.resize(count);
+    return best;
+}
+
+void GPPalletDemandMinimisation::KeepNodeOutputs()
+{
+    auto const Elites = Best(IncrementalElites);
+    auto const Count = Elites.size();
+
+    // Take over the outputs of the elites which survived
+    std::vector<std::unique_ptr<NodeOutputs const>> kept(Count);
+    for(std::size_t i{}; i != Count; ++i)
+        for(auto& outputs: nodeOutputs_)
+            if(outputs && outputs->Function() == View(population_[Elites[i]]))
+            {
+                kept[i] = std::move(outputs);
+                break;
+            }
+
+    // Evaluate the new ones
+    auto const Rows = historicalData_.RowCount();
+    auto const MaxBytes = NodeOutputBudget / IncrementalElites;
+    std::for_each(
+        std::execution::par,
+        kept.begin(),
+        kept.end(),
+        [&](auto& outputs)
+        {
+            auto const Function = View(
+                population_[Elites[&outputs - kept.data()]]);
+            if(!outputs && Function.Count() * Rows * sizeof(double) <= MaxBytes)
+                outputs = std::make_unique<NodeOutputs const>(
+                    Function,
+                    historicalData_.BeginColumnData(),
+                    Rows,
+                    Rows);
+        });
+
+    nodeOutputs_.swap(kept);
+    outputsOf_.assign(population_.size(), nullptr);
+    for(std::size_t i{}; i != Count; ++i)
+        outputsOf_[Elites[i]] = nodeOutputs_[i].get();
+}
+
+void GPPalletDemandMinimisation::EvaluateOffspring(
+    PalletData& data,
+    FitnessCache& cache,
+    std::vector<SubtreeStore::NodeId> const& roots,
+    bool shareSubtrees)
+{
+    auto const Rows = data.RowCount();
+    auto const Columns = data.BeginColumnData();
+    auto const Replacement = [&](std::size_t i) noexcept
+    {
+        auto const& Lineage = lineages_[i];
+        return broods_[offspring_[i].brood].offspring.View(Lineage.bred)
+            .SubExpr(Lineage.node);
+    };
+
+    // An offspring evaluated from the outputs of its parent costs about the
+    // size of the subtree it got, the parents are kept over the historical
+    // data only
+    std::vector<EvalCost> costs(offspring_.size());
+    for(std::size_t i{}; i != offspring_.size(); ++i)
+    {
+        if(!std::isnan(offspring_[i].fitness))
+            continue;
+        if(lineages_[i].parent != nullptr)
+            costs[i] = EvalCost{Replacement(i).Count(), true};
+        else
+            costs[i] = EvalCost{View(offspring_[i]).Count(), !shareSubtrees};
+    }
+
+    auto const Workers = std::max<std::size_t>(
+        std::thread::hardware_concurrency(),
+        1);
+    auto const Tiles = SplitTiles(costs, Rows, Workers);
+
+    // Over enough rows every splittable individual without a parent is
+    // compiled, whether it has one tile or several, and its tiles share the
+    // one compiled function. The rows in all, not those of a tile, pay off
+    // the compiling.
+    std::vector<std::optional<CompiledExpr>> compiled(offspring_.size());
+    if(CompiledExpr::Available && MinCompiledRows <= Rows)
+        std::for_each(
+            std::execution::par,
+            compiled.begin(),
+            compiled.end(),
+            [&](auto& function)
+            {
+                auto const I = static_cast<std::size_t>(
+                    &function - compiled.data());
+                if(costs[I].perRow != 0
+                    && costs[I].splittable
+                    && lineages_[I].parent == nullptr)
+                    function.emplace(Expr{View(offspring_[I])});
+            });
+
+    // Every worker takes the next tile in order, the largest first, so the
+    // small ones fill in at the end (longest processing time first)
+    std::vector<double> errors(Tiles.size());
+    std::atomic<std::size_t> nextTile{};
+    tileEstemates_.resize(Workers);
+    std::for_each(
+        std::execution::par,
+        tileEstemates_.begin(),
+        tileEstemates_.end(),
+        [&](auto& estemates)
+        {
+            for(auto t = nextTile++; t < Tiles.size(); t = nextTile++)
+            {
+                auto const& Tile = Tiles[t];
+                auto const I = Tile.individual;
+                auto const& Lineage = lineages_[I];
+                if(!costs[I].splittable)
+                {
+                    auto const Estemates = store_.Eval(
+                        roots[I],
+                        Columns,
+                        Rows,
+                        Rows);
+                    errors[t] = AbsoluteError(
+                        data,
+                        Estemates.get(),
+                        0,
+                        Rows);
+                    continue;
+                }
+
+                estemates.resize(std::max(estemates.size(), Tile.count));
+                if(Lineage.parent != nullptr)
+                    Lineage.parent->EvalSpliced(
+                        Lineage.node,
+                        Replacement(I),
+                        Columns,
+                        Rows,
+                        Tile.first,
+                        Tile.count,
+                        estemates.data());
+                else if(compiled[I])
+                    compiled[I]->Eval(
+                        Columns + Tile.first,
+                        Rows,
+                        Tile.count,
+                        estemates.data());
+                else
+                    View(offspring_[I]).Eval(
+                        Columns + Tile.first,
+                        Rows,
+                        Tile.count,
+                        estemates.data());
+                errors[t] = AbsoluteError(
+                    data,
+                    estemates.data(),
+                    Tile.first,
+                    Tile.count);
+            }
+        });
+
+    // Sum the tiles of every individual in order, so the fitness does not
+    // depend on the order the tiles were done in
+    std::vector<double> totals(offspring_.size());
+    std::vector<std::size_t> order(Tiles.size());
+    std::iota(order.begin(), order.end(), std::size_t{});
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) noexcept
+    {
+        return Tiles[a].individual != Tiles[b].individual
+            ? Tiles[a].individual < Tiles[b].individual
+            : Tiles[a].first < Tiles[b].first;
+    });
+    for(auto t: order)
+        totals[Tiles[t].individual] += errors[t];
+
+    for(std::size_t i{}; i != offspring_.size(); ++i)
+    {
+        if(costs[i].perRow == 0)
+            continue;
+
+        auto const Fitness = totals[i] / data.TotalWeight();
+        offspring_[i].fitness = std::isnan(Fitness)
+            ? std::numeric_limits<double>::infinity()
+            : Fitness;
+        cache.Insert(
+            View(offspring_[i]),
+            offspring_[i].hash,
+            offspring_[i].fitness);
+    }
+}
+
+void GPPalletDemandMinimisation::Screen(PalletData const& data)
+{
+    std::vector<Interval> args(data.DataCount());
+    for(std::size_t j{}; j != args.size(); ++j)
+        args[j] = Interval{data.ColumnMin(j), data.ColumnMax(j)};
+
+    // The archive is of the fitness on the historical data only
+    auto const Full = &data == &historicalData_;
+    std::for_each(
+        std::execution::par,
+        offspring_.begin(),
+        offspring_.end(),
+        [&](auto& c)
+        {
+            if(!std::isnan(c.fitness))
+                return;
+
+            auto const Function = View(c);
+            auto const Range = Function.Range(args.data());
+            // MinError takes any other infinite bound as unbounded
+            auto const Infinite = std::isinf(Range.lo)
+                && Range.lo == Range.hi;
+            if(Infinite || (Full && !archive_.Accepts(
+                data.MinError(Range.lo, Range.hi),
+                Function.Count())))
+                c.fitness = std::numeric_limits<double>::infinity();
+        });
+}
+
+void GPPalletDemandMinimisation::Cull(std::size_t rows)
+{
+    // An offspring evaluated from the outputs of its parent costs about the
+    // size of the subtree it got
+    auto const Cost = [&](std::size_t i) noexcept
+    {
+        auto const& Lineage = lineages_[i];
+        if(Lineage.parent == nullptr)
+            return View(offspring_[i]).Count();
+        return broods_[offspring_[i].brood].offspring.View(Lineage.bred)
+            .SubExpr(Lineage.node).Count();
+    };
+
+    std::vector<std::size_t> unknown{};
+    std::size_t nodes{};
+    for(std::size_t i{}; i != offspring_.size(); ++i)
+        if(std::isnan(offspring_[i].fitness))
+        {
+            unknown.push_back(i);
+            nodes += Cost(i);
+        }
+    if(nodes * rows <= EvaluationBudget)
+        return;
+
+    auto const Average = nodes / unknown.size();
+    std::shuffle(unknown.begin(), unknown.end(), rng_);
+    for(auto i: unknown)
+    {
+        if(nodes * rows <= EvaluationBudget)
+            break;
+        if(auto const C = Cost(i); Average < C)
+        {
+            nodes -= C;
+            offspring_[i].fitness = std::numeric_limits<double>::infinity();
+        }
+    }
+}
+
+void GPPalletDemandMinimisation::TuneConstants(PalletData& data)
+{
+    for(auto i: Best(MemeticCount))
+    {
+        auto& c = population_[i];
+        auto const Function = View(c);
+        if(Function.ConstCount() == 0)
+            continue;
+
+        auto const Compiled = Compile(data, Function);
+        GPConstantMinimisation pso{
+            GPConstantTuning{
+                &data,
+                Function,
+                Compiled ? &*Compiled : nullptr,
+                rng_()},
+            TuningParticles,
+            TuningIterations};
+        auto const Result = Simulate(pso);
+        if(!(Result.fitness < c.fitness))
+            continue;
+
+        // The individual keeps its shape, so the constants are written over
+        std::copy(
+            Result.position.cbegin(),
+            Result.position.cend(),
+            broods_[c.brood].population.Consts(c.function));
+        c.fitness = Result.fitness;
+        c.hash = Function.Hash();
+        CacheOf(data).Insert(Function, c.hash, c.fitness);
+    }
+}
+
+PalletData& GPPalletDemandMinimisation::EvaluationData()
+{
+    if(!coreset_)
+        return historicalData_;
+
+    auto const Fraction = Fidelity(iteration_, FidelityRamp, MinFidelity);
+    if(Fraction < CoresetFidelity)
+        return *coreset_;
+
+    if(1.0 <= Fraction)
+        return historicalData_;
+
+    // Round the fidelity down to a doubling of the coreset's
+    auto const Level = std::floor(std::log2(Fraction / CoresetFidelity));
+    auto const Size = static_cast<std::size_t>(
+        std::ldexp(CoresetFidelity, static_cast<int>(Level))
+        * historicalData_.RowCount());
+    if(!sample_ || sample_->RowCount() != Size)
+    {
+        sample_ = Subsample(historicalData_, Size, rng_);
+        standInCache_.Clear();
+    }
+
+    return *sample_;
+}
+
+FitnessCache& GPPalletDemandMinimisation::CacheOf(
+    PalletData const& data) noexcept
+{
+    return &data == &historicalData_ ? cache_ : standInCache_;
+}
+
+void GPPalletDemandMinimisation::ConfirmBest()
+{
+    for(auto i: Best(ConfirmCount))
+    {
+        auto const Function = View(population_[i]);
+        auto const Hash = population_[i].hash;
+        auto fitness = cache_.Find(Function, Hash);
+        if(!fitness)
+        {
+            auto const Compiled = Compile(historicalData_, Function);
+            fitness = Compiled
+                ? Estemate(historicalData_, *Compiled)
+                : Estemate(historicalData_, Function);
+            cache_.Insert(Function, Hash, *fitness);
+        }
+
+        archive_.Insert(Function, *fitness);
+    }
+}
+
+GPIslandPalletDemandMinimisation::GPIslandPalletDemandMinimisation(
+    PalletData historicalData,
+    std::size_t islandCount,
+    std::size_t populationSize,
+    MigrationTopology topology)
+    : topology_{topology}
+{
+    for(std::size_t i{}; i != islandCount; ++i)
+        islands_.emplace_back(historicalData, populationSize);
+    for(std::size_t i{}; i != islandCount * islandCount; ++i)
+        queues_.push_back(std::make_unique<Queue>(MigrationQueueSize));
+}
+
+void GPIslandPalletDemandMinimisation::Initialise()
+{
+    generation_ = 0;
+    std::random_device seeder{};
+    rngs_.resize(islands_.size());
+    for(auto& rng: rngs_)
+        rng.seed(seeder());
+    for(auto& queue: queues_)
+        while(queue->TryPop())
+            ;
+    for(auto& island: islands_)
+        island.Initialise();
+}
+
+void GPIslandPalletDemandMinimisation::Step()
+{
+    ++generation_;
+    std::vector<std::size_t> ids(islands_.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    std::for_each(
+        std::execution::par,
+        ids.cbegin(),
+        ids.cend(),
+        [&](auto i) { Evolve(i); });
+}
+
+bool GPIslandPalletDemandMinimisation::Terminate() noexcept
+{
+    // Every island counts its generations
+    auto done = false;
+    for(auto& island: islands_)
+        done = island.Terminate() || done;
+    return done;
+}
+
+std::vector<GPIslandPalletDemandMinimisation::Result>
+GPIslandPalletDemandMinimisation::Complete()
+{
+    ParetoArchive front{};
+    for(auto& island: islands_)
+        for(auto const& entry: island.Complete())
+            front.Insert(entry.function, entry.fitness);
+    return front.Front();
+}
+
+void GPIslandPalletDemandMinimisation::Evolve(std::size_t island)
+{
+    auto const Count = islands_.size();
+    auto& gp = islands_[island];
+    gp.Step();
+
+    // Take in whatever migrants have arrived
+    for(std::size_t from{}; from != Count; ++from)
+        if(from != island)
+            while(auto migrant = QueueOf(from, island).TryPop())
+                gp.Immigrate(*migrant);
+
+    if(Count == 1 || generation_ % MigrationInterval != 0)
+        return;
+
+    auto to = (island + 1) % Count;
+    if(topology_ == MigrationTopology::Random)
+    {
+        to = std::uniform_int_distribution<std::size_t>{
+            0,
+            Count - 2}(rngs_[island]);
+        to += island <= to;
+    }
+
+    for(auto& migrant: gp.Elites(MigrantCount))
+        QueueOf(island, to).TryPush(std::move(migrant));
+}
+
+typename GPIslandPalletDemandMinimisation::Queue&
+GPIslandPalletDemandMinimisation::QueueOf(
+    std::size_t from,
+    std::size_t to)
+    noexcept
+{
+    return *queues_[from * islands_.size() + to];
+}
+
+GPSteadyStatePalletDemandMinimisation::GPSteadyStatePalletDemandMinimisation(
+    PalletData historicalData,
+    std::size_t populationSize,
+    std::size_t laneCount)
+    : population_{std::make_unique<Slot[]>(populationSize)}
+    , historicalData_{std::move(historicalData)}
+    , PopulationSize_{populationSize}
+    , LaneCount_{laneCount}
+{
+}
+
+GPSteadyStatePalletDemandMinimisation::~GPSteadyStatePalletDemandMinimisation()
+{
+    Stop();
+}
+
+void GPSteadyStatePalletDemandMinimisation::Initialise()
+{
+    Stop();
+    std::minstd_rand rng{std::random_device{}()};
+    cache_.Clear();
+    iteration_ = 0;
+    archive_ = ParetoArchive{};
+
+    // Ramped half-and-half
+    ExprArena arena{};
+    for(std::size_t i{}; i != PopulationSize_; ++i)
+    {
+        arena.Clear();
+        auto const Function = arena.Write([&](ExprWriter& out)
+        {
+            WriteRampedExpr(
+                out,
+                rng,
+                historicalData_.DataCount(),
+                MinInitialDepth,
+                InitialDepth,
+                GrowTerminalPropability);
+        });
+        population_[i].function = std::make_shared<Expr const>(
+            arena.View(Function));
+    }
+
+    std::for_each(
+        std::execution::par,
+        population_.get(),
+        population_.get() + PopulationSize_,
+        [&](auto& slot)
+        {
+            slot.fitness = Fitness(*slot.function);
+        });
+
+    for(std::size_t i{}; i != PopulationSize_; ++i)
+        archive_.Insert(*population_[i].function, population_[i].fitness);
+    Start();
+}
+
+void GPSteadyStatePalletDemandMinimisation::Step()
+{
+    std::unique_lock<std::mutex> lock{progressMutex_};
+    auto const MaxOffspring = MaxIteration * PopulationSize_;
+    quota_ = std::min((iteration_ + 1) * PopulationSize_, MaxOffspring);
+    target_ = std::min(iteration_ * PopulationSize_, MaxOffspring);
+    quotaRaised_.notify_all();
+    evaluated_.wait(lock, [&]()
+    {
+        return target_ <= evaluatedCount_ || error_;
+    });
+
+    if(auto const Error = error_)
+    {
+        lock.unlock();
+        Stop();
+        std::rethrow_exception(Error);
+    }
+}
+
+bool GPSteadyStatePalletDemandMinimisation::Terminate() noexcept
+{
+    if(MaxIteration < ++iteration_)
+    {
+        Stop();
+        return true;
+    }
+
+    return false;
+}
+
+std::vector<GPSteadyStatePalletDemandMinimisation::Result>
+GPSteadyStatePalletDemandMinimisation::Complete()
+{
+    // The initial population may not be simplified
+    std::lock_guard<std::mutex> lock{archiveMutex_};
+    ParetoArchive front{};
+    for(auto const& entry: archive_.Front())
+        front.Insert(entry.function.Simplify(), entry.fitness);
+    return front.Front();
+}
+
+FitnessCache const& GPSteadyStatePalletDemandMinimisation::Cache()
+    const noexcept
+{
+    return cache_;
+}
 
-class GPPalletDemandMinimisation final
+void GPSteadyStatePalletDemandMinimisation::Start()
 {
-public:
-    struct Result
     {
-        Expr function;
-        double fitness;
-    };
+        std::lock_guard<std::mutex> lock{progressMutex_};
+        bredCount_ = 0;
+        evaluatedCount_ = 0;
+        quota_ = 0;
+        target_ = 0;
+        error_ = nullptr;
+    }
+    stopping_ = false;
 
-    explicit GPPalletDemandMinimisation(
-        PalletData historicalData,
-        std::size_t populationSize)
-        noexcept;
+    std::random_device seeder{};
+    for(std::size_t i{}; i != LaneCount_; ++i)
+    {
+        lanes_.push_back(std::make_unique<Lane>(LaneSize));
+        auto& lane = *lanes_.back();
+        threads_.emplace_back([this, &lane, Seed = seeder()]()
+        {
+            try
+            {
+                Breed(lane, Seed);
+            }
+            catch(...)
+            {
+                Fail(std::current_exception());
+            }
+            lane.queue.Close();
+        });
+        threads_.emplace_back([this, &lane, Seed = seeder()]()
+        {
+            try
+            {
+                Evaluate(lane, Seed);
+            }
+            catch(...)
+            {
+                Fail(std::current_exception());
+            }
 
-    void Initialise();
+            // Drain the lane so that the breeder does not wait on it
+            while(lane.queue.Pop())
+                continue;
+        });
+    }
+}
 
-    void Step();
+void GPSteadyStatePalletDemandMinimisation::Stop() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock{progressMutex_};
+        stopping_ = true;
+    }
+    quotaRaised_.notify_all();
 
-    bool Terminate() noexcept;
-    
-    Result Complete();
-private:
-    struct Individual
+    for(auto& thread: threads_)
+        thread.join();
+    threads_.clear();
+    lanes_.clear();
+}
+
+bool GPSteadyStatePalletDemandMinimisation::Reserve(std::size_t count)
+{
+    std::unique_lock<std::mutex> lock{progressMutex_};
+    quotaRaised_.wait(lock, [&]()
     {
-        Expr function;
-        double fitness;
-    };
+        return stopping_ || bredCount_ < quota_;
+    });
+    if(stopping_)
+        return false;
 
-    // Configuration
-    constexpr static std::size_t MaxExpressionSize = 1000;
-    constexpr static std::size_t TournamentSize = 4;
-    constexpr static std::size_t InitialDepth = 2;
-    constexpr static std::size_t MutationDepth = 2;
-    constexpr static std::size_t MaxIteration = 1000;
-    constexpr static double MutationPropability = 0.05;
-    constexpr static double ReplicationPropabillity = 0.15;
-    constexpr static double CrossoverProbabillity = 1 - (MutationPropability
-        + ReplicationPropabillity);
+    bredCount_ += count;
+    return true;
+}
 
-    std::vector<Individual> population_;
+void GPSteadyStatePalletDemandMinimisation::Fail(std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> lock{progressMutex_};
+        if(!error_)
+            error_ = error;
+        stopping_ = true;
+    }
+    quotaRaised_.notify_all();
+    evaluated_.notify_all();
+}
 
-    PalletData historicalData_;
+void GPSteadyStatePalletDemandMinimisation::Breed(
+    Lane& lane,
+    std::minstd_rand::result_type seed)
+{
+    std::minstd_rand rng{seed};
+    ExprArena arena{};
+    auto const Push = [&](Expr&& child)
+    {
+        // The operators never breed an offspring which is too large
+        assert(child.Count() <= MaxExpressionSize && "Offspring too large");
 
-    std::minstd_rand rng_{};
+        // Wait for the evaluator to catch up
+        lane.queue.Push(child.Simplify());
+    };
 
-    double bestFitness_ = std::numeric_limits<double>::infinity();
+    while(true)
+    {
+        auto const Total = MutationPropability + ReplicationPropabillity
+            + CrossoverProbabillity;
+        auto const X = std::uniform_real_distribution<>{0, Total }(rng);
+        auto const Crossover = MutationPropability + ReplicationPropabillity
+            <= X;
+        if(!Reserve(Crossover ? 2 : 1))
+            return;
+
+        if(X < MutationPropability)
+        {
+            // Select and mutate
+            // A single terminal is replaced whole, the mutation is no
+            // deeper than fits in place of the node
+            auto const Parent = this->Parent(Tournament(rng, false));
+            auto const Id = DepthFairNode(*Parent, rng);
+            auto const Room = MaxExpressionSize
+                - (Parent->Count() - ExprView{*Parent}.BeginExtents()[Id].size);
+            arena.Clear();
+            auto const Mutation = arena.View(arena.Write(
+                [&](ExprWriter& out)
+                {
+                    WriteRandomExpr(
+                        out,
+                        rng,
+                        historicalData_.DataCount(),
+                        std::min(MutationDepth, FullDepthWithin(Room)),
+                        0.0);
+                }));
+            Push(Id == 0 ? Expr{Mutation} : Expr{*Parent, Id, Mutation});
+        }
+        else if(X < MutationPropability + ReplicationPropabillity)
+        {
+            // Select and replicate
+            Push(Expr{*Parent(Tournament(rng, false))});
+        }
+        else
+        {
+            // Select and crossover
+            auto const ParentA = Parent(Tournament(rng, false));
+            auto const ParentB = Parent(Tournament(rng, false));
+            auto [childA, childB] = SubtreeCrossover(
+                *ParentA,
+                *ParentB,
+                MaxExpressionSize,
+                rng);
+            Push(std::move(childA));
+            Push(std::move(childB));
+        }
+    }
+}
+
+void GPSteadyStatePalletDemandMinimisation::Evaluate(
+    Lane& lane,
+    std::minstd_rand::result_type seed)
+{
+    std::minstd_rand rng{seed};
+    while(auto offspring = lane.queue.Pop())
+    {
+        // Whatever is left once the run stops is dropped
+        if(stopping_)
+            continue;
 
-    Expr bestFunction_ = Const(0);
+        auto const OffspringFitness = Fitness(*offspring);
 
-    std::size_t iteration_{};
+        // Replace the loser of a tournament if the offspring is fitter
+        auto replaced = false;
+        {
+            auto& loser = Tournament(rng, true);
+            std::lock_guard<std::mutex> lock{loser.mutex};
+            if(OffspringFitness < loser.fitness)
+            {
+                loser.function = std::make_shared<Expr const>(*offspring);
+                loser.fitness = OffspringFitness;
+                replaced = true;
+            }
+        }
 
-    std::size_t PopulationSize_;
-};
+        if(replaced)
+        {
+            std::lock_guard<std::mutex> lock{archiveMutex_};
+            archive_.Insert(*offspring, OffspringFitness);
+        }
 
-int main(int argc, char const** argv) try
+        // Only the step waiting for the target is woken
+        std::lock_guard<std::mutex> lock{progressMutex_};
+        if(++evaluatedCount_ == target_)
+            evaluated_.notify_all();
+    }
+}
+
+template<typename RngT>
+typename GPSteadyStatePalletDemandMinimisation::Slot&
+GPSteadyStatePalletDemandMinimisation::Tournament(RngT& rng, bool loser)
 {
-    auto dataSet = ReadPalletData(argc, argv, std::cout);
+    std::uniform_int_distribution<std::size_t> distribution{
+        0,
+        PopulationSize_ - 1};
+    Slot* best = nullptr;
+    double bestFitness{};
+    for(std::size_t i{}; i != TournamentSize; ++i)
+    {
+        auto& slot = population_[distribution(rng)];
+        double fitness;
+        {
+            std::lock_guard<std::mutex> lock{slot.mutex};
+            fitness = slot.fitness;
+        }
 
-    auto const PopulationSize = 100;
-    GPPalletDemandMinimisation gp{ dataSet.trainingData, PopulationSize };
-    auto result = Simulate(gp);
+        if(best == nullptr
+            || (loser ? bestFitness < fitness : fitness < bestFitness))
+        {
+            best = &slot;
+            bestFitness = fitness;
+        }
+    }
 
-    std::cout
-        << Estemate(dataSet.testingData, result.function) << "| "
-        << result.function << "\n";
+    return *best;
 }
-catch (InvalidFileName& e)
+
+std::shared_ptr<Expr const> GPSteadyStatePalletDemandMinimisation::Parent(
+    Slot& slot)
 {
-    std::cout << "Cannot read file: " << e.what();
+    std::lock_guard<std::mutex> lock{slot.mutex};
+    return slot.function;
 }
-catch (std::exception& e)
+
+double GPSteadyStatePalletDemandMinimisation::Fitness(Expr const& function)
 {
-    std::cout << e.what();
+    auto const Hash = function.Hash();
+    if(auto const Known = cache_.Find(function, Hash))
+        return *Known;
+
+    auto const Compiled = Compile(historicalData_, function);
+    auto const Fitness = Compiled
+        ? Estemate(historicalData_, *Compiled)
+        : Estemate(historicalData_, function);
+    cache_.Insert(function, Hash, Fitness);
+    return Fitness;
 }
 
-GPPalletDemandMinimisation::GPPalletDemandMinimisation(
+LinearGPPalletDemandMinimisation::LinearGPPalletDemandMinimisation(
     PalletData historicalData,
     std::size_t populationSize)
     noexcept
-    : population_{}
-    , historicalData_{std::move(historicalData)}
+    : historicalData_{std::move(historicalData)}
     , PopulationSize_{populationSize}
 {
 }
 
-void GPPalletDemandMinimisation::Initialise()
+void LinearGPPalletDemandMinimisation::Initialise()
 {
     rng_.seed(std::random_device{}());
+    iteration_ = 0;
+    bestFitness_ = std::numeric_limits<double>::infinity();
     population_.clear();
     std::generate_n(
         std::back_inserter(population_),
         PopulationSize_,
-        [&]()
-        {
-            Individual c{
-                GenerateRandomExpr(
-                    rng_,
-                    historicalData_.DataCount(),
-                    InitialDepth),
-                0.0};
-            c.fitness = Estemate(historicalData_, c.function);
-            return c;
-        });
+        [&]() { return Individual{RandomProgram(), 0.0}; });
 
+    std::for_each(
+        std::execution::par,
+        population_.begin(),
+        population_.end(),
+        [&](auto& c)
+        {
+            c.fitness = Estemate(historicalData_, c.program);
+        });
 }
 
-void GPPalletDemandMinimisation::Step()
+void LinearGPPalletDemandMinimisation::Step()
 {
-    std::vector<Individual> newGeneration{};
-    while(newGeneration.size() < population_.size())
+    auto const ByFitness = [](auto const& a, auto const& b) noexcept
+    {
+        return a.fitness < b.fitness;
+    };
+    auto const Select = [&]() -> LinearProgram const&
+    {
+        return Tournament(
+            population_.cbegin(),
+            population_.cend(),
+            TournamentSize,
+            rng_,
+            ByFitness)->program;
+    };
+
+    // Breeding only copies and edits arrays, the unknown fitness is NaN
+    auto const Unknown = std::numeric_limits<double>::quiet_NaN();
+    offspring_.clear();
+    while(offspring_.size() < population_.size())
     {
         auto const Total = MutationPropability + ReplicationPropabillity
             + CrossoverProbabillity;
-        auto const X = std::uniform_real_distribution<>{0, Total }(rng_);
+        auto const X = std::uniform_real_distribution<>{0, Total}(rng_);
         if(X < MutationPropability)
         {
-            // Select and mutate
-            auto it = Roulette(
-                population_.cbegin(),
-                population_.cend(),
-                rng_,
-                [](auto const& c) noexcept { return 1 / c.fitness; });
-
-            auto temp = it->function;
-            using Distribution = std::uniform_int_distribution<std::size_t>;
-            auto const Id = Distribution{ 1, temp.Count() - 1 }(rng_);
-            temp.Replace(
-                Id,
-                GenerateRandomExpr(
-                    rng_,
-                    historicalData_.DataCount(),
-                    MutationDepth));
-
-            newGeneration.emplace_back(Individual{std::move(temp), 0.0});
+            auto child = Select();
+            Mutate(child);
+            offspring_.push_back(Individual{std::move(child), Unknown});
         }
         else if(X < MutationPropability + ReplicationPropabillity)
-        {
-            // Select and replicate
-            auto it = Roulette(
+            offspring_.push_back(*Tournament(
                 population_.cbegin(),
                 population_.cend(),
+                TournamentSize,
                 rng_,
-                [](auto const& c) noexcept { return 1 / c.fitness; });
-            newGeneration.emplace_back(*it);
-        }
+                ByFitness));
         else
         {
-            // Select and crossover
-            // Find the first parent using a tornament
-            auto i = SampleGroup(
-                population_.begin(),
-                population_.end(),
-                TournamentSize, rng_);
-            i = std::min_element(
-                population_.begin(),
-                i,
-                [](auto const& a, auto const& b) noexcept
-                {
-                    return a.fitness < b.fitness;
-                });
-            std::iter_swap(population_.begin(), i);
-
-            // Find the second parent using a tornament
-            i = SampleGroup(
-                population_.begin() + 1,
-                population_.end(),
-                TournamentSize,
-                rng_);
-            i = std::min_element(
-                population_.begin(),
-                i,
-                [](auto const& a, auto const& b) noexcept
-                {
-                    return a.fitness < b.fitness;
-                });
-            std::iter_swap(population_.begin() + 1, i);
-
-            auto [childA, childB] = SubtreeCrossover(
-                population_[0].function,
-                population_[1].function,
-                rng_);
-
-            newGeneration.emplace_back(Individual{std::move(childA), 0.0});
-            newGeneration.emplace_back(Individual{std::move(childB), 0.0});
+            auto childA = Select();
+            auto childB = Select();
+            Crossover(childA, childB);
+            offspring_.push_back(Individual{std::move(childA), Unknown});
+            offspring_.push_back(Individual{std::move(childB), Unknown});
         }
     }
 
-    std::for_each(newGeneration.begin(),
-        newGeneration.end(),
-        [&](auto& c)
-        {
-            // Control the growth
-            // weed out the large trees and replace them with new ones
-            if(MaxExpressionSize < c.function.Count())
-                c.function = GenerateRandomExpr(
-                    rng_,
-                    historicalData_.DataCount(),
-                    InitialDepth);
-        });
-
-    // Evaluate all the new individuals
     std::for_each(
         std::execution::par,
-        newGeneration.begin(),
-        newGeneration.end(),
+        offspring_.begin(),
+        offspring_.end(),
         [&](auto& c)
         {
-            c.fitness = Estemate(historicalData_, c.function);
+            if(std::isnan(c.fitness))
+                c.fitness = Estemate(historicalData_, c.program);
         });
 
-
     // Fit the next generation
-    while(population_.size() < newGeneration.size())
+    if(population_.size() < offspring_.size())
     {
-        auto it = std::max_element(
-            std::execution::par,
-            newGeneration.cbegin(),
-            newGeneration.cend(),
-            [](auto const& a, auto const& b) noexcept
-            {
-                return a.fitness < b.fitness;
-            });
-        newGeneration.erase(it);
+        std::nth_element(
+            offspring_.begin(),
+            offspring_.begin() + population_.size(),
+            offspring_.end(),
+            ByFitness);
+        offspring_.resize(population_.size());
     }
 
-    // Next generation
-    population_ = std::move(newGeneration);
+    population_.swap(offspring_);
 
-    // Find the best individual
     auto i = std::min_element(
-        std::execution::par,
         population_.cbegin(),
         population_.cend(),
-        [](auto const& a, auto const& b) noexcept
-        {
-            return a.fitness < b.fitness;
-        });
-
-    // Is the best individual the best overall?
+        ByFitness);
     if (i->fitness < bestFitness_)
     {
-        // Uncomment this to see the development... Useful for debugging!
-        //std::cout << ">>> " << iteration_
-        //    << ": " << i->fitness
-        //    << " [" << i->function << "]\n";
-        bestFunction_ = i->function;
+        bestProgram_ = i->program;
         bestFitness_ = i->fitness;
     }
 }
 
-bool GPPalletDemandMinimisation::Terminate() noexcept
+bool LinearGPPalletDemandMinimisation::Terminate() noexcept
 {
     return MaxIteration < ++iteration_;
 }
 
-typename GPPalletDemandMinimisation::Result
-GPPalletDemandMinimisation::Complete()
+typename LinearGPPalletDemandMinimisation::Result
+LinearGPPalletDemandMinimisation::Complete()
+{
+    return {RemoveIntrons(bestProgram_), bestFitness_};
+}
+
+internal::LinearInstr LinearGPPalletDemandMinimisation::RandomInstr()
 {
-    return {bestFunction_, bestFitness_};
+    // Division is forbidden as for the trees, see WriteRandomExpr
+    using Distribution = std::uniform_int_distribution<std::size_t>;
+    auto const Sources = RegisterCount + historicalData_.DataCount()
+        + ConstCount;
+    auto const Op = Distribution{
+        internal::OpCode::Add,
+        internal::OpCode::Mul}(rng_);
+    auto const Dst = Distribution{0, RegisterCount - 1}(rng_);
+    auto const Lhs = Distribution{0, Sources - 1}(rng_);
+    auto const Rhs = Distribution{0, Sources - 1}(rng_);
+    return internal::LinearInstr{
+        static_cast<std::uint8_t>(Op),
+        static_cast<std::uint8_t>(Dst),
+        static_cast<std::uint16_t>(Lhs),
+        static_cast<std::uint16_t>(Rhs)};
 }
 
-double Estemate(PalletData& data, Expr const& expr)
+LinearProgram LinearGPPalletDemandMinimisation::RandomProgram()
 {
-    std::vector<double> estemates{};
-    for(std::size_t i{}; i != data.RowCount(); ++i)
-        estemates.push_back(expr.Eval(data.BeginRowData(i)));
+    LinearProgram program{
+        {},
+        {},
+        RegisterCount,
+        historicalData_.DataCount()};
+    auto const Length = std::uniform_int_distribution<std::size_t>{
+        MinInitialLength,
+        MaxInitialLength}(rng_);
+    std::generate_n(
+        std::back_inserter(program.code),
+        Length,
+        [&]() { return RandomInstr(); });
+    std::generate_n(
+        std::back_inserter(program.consts),
+        ConstCount,
+        [&]() { return std::uniform_real_distribution<>{ 0, 100 }(rng_); });
+    return program;
+}
 
-    auto const Total = std::transform_reduce(
-        std::execution::par,
-        estemates.cbegin(),
-        estemates.cend(),
-        data.BeginDemand(),
-        0.0,
-        std::plus<double>{},
-        [](auto a, auto b) noexcept {return std::abs(a - b);});
-
-    auto const Estemation = Total / data.RowCount();
+void LinearGPPalletDemandMinimisation::Mutate(LinearProgram& program)
+{
+    using Distribution = std::uniform_int_distribution<std::size_t>;
+    auto& code = program.code;
+    auto const X = std::uniform_real_distribution<>{0, 1}(rng_);
+    if(X < MicroMutationPropability)
+    {
+        // Take a single field from a random instruction
+        auto const Other = RandomInstr();
+        auto& instr = code[Distribution{0, code.size() - 1}(rng_)];
+        switch (Distribution{0, 4}(rng_))
+        {
+        case 0:
+            instr.op = Other.op;
+            break;
+        case 1:
+            instr.dst = Other.dst;
+            break;
+        case 2:
+            instr.lhs = Other.lhs;
+            break;
+        case 3:
+            instr.rhs = Other.rhs;
+            break;
+        default:
+            {
+                auto& c = program.consts[
+                    Distribution{0, program.consts.size() - 1}(rng_)];
+                c += std::normal_distribution<>{0, ConstSpread}(rng_)
+                    * (std::abs(c) + 1);
+            }
+        }
+    }
+    else if(code.size() == 1
+        || (code.size() < MaxLength && X < (1 + MicroMutationPropability) / 2))
+        code.insert(
+            code.begin() + Distribution{0, code.size()}(rng_),
+            RandomInstr());
+    else
+        code.erase(code.begin() + Distribution{0, code.size() - 1}(rng_));
+}
+
+void LinearGPPalletDemandMinimisation::Crossover(
+    LinearProgram& a,
+    LinearProgram& b)
+{
+    // Pick a segment of at least one instruction from each
+    using Distribution = std::uniform_int_distribution<std::size_t>;
+    auto const Segment = [&](auto const& code)
+    {
+        auto const First = Distribution{0, code.size() - 1}(rng_);
+        auto const Last = Distribution{First + 1, code.size()}(rng_);
+        return std::make_pair(First, Last);
+    };
+    auto const [FirstA, LastA] = Segment(a.code);
+    auto const [FirstB, LastB] = Segment(b.code);
+
+    // The children would grow too long
+    auto const LengthA = LastA - FirstA;
+    auto const LengthB = LastB - FirstB;
+    if(MaxLength < a.code.size() - LengthA + LengthB
+        || MaxLength < b.code.size() - LengthB + LengthA)
+        return;
+
+    std::vector<internal::LinearInstr> segmentA(
+        a.code.begin() + FirstA,
+        a.code.begin() + LastA);
+    a.code.erase(a.code.begin() + FirstA, a.code.begin() + LastA);
+    a.code.insert(
+        a.code.begin() + FirstA,
+        b.code.begin() + FirstB,
+        b.code.begin() + LastB);
+    b.code.erase(b.code.begin() + FirstB, b.code.begin() + LastB);
+    b.code.insert(b.code.begin() + FirstB, segmentA.begin(), segmentA.end());
+}
+
+GPConstantOptimisation::GPConstantOptimisation(GPConstantTuning const& tuning)
+    : tuning_{tuning}
+{
+}
+
+void GPConstantOptimisation::Init(Particles& particles)
+{
+    auto const Count = particles.VectorSize();
+    auto const Consts = tuning_.function.BeginConsts();
+
+    std::minstd_rand seeder{tuning_.seed};
+    rngs_.resize(particles.PopulationSize());
+    for(auto& rng: rngs_)
+        rng.seed(seeder());
+
+    particles.ForAll([&](auto&& p)
+    {
+        if(p.id == 0)
+            std::copy(Consts, Consts + Count, p.position);
+        else
+            std::transform(
+                Consts,
+                Consts + Count,
+                p.position,
+                [&](auto x)
+                {
+                    using Distribution = std::normal_distribution<>;
+                    return x + Distribution{0, Spread}(rngs_[p.id])
+                        * (std::abs(x) + 1);
+                });
+        std::copy(p.position, p.position + Count, p.bestPosition);
+        std::fill(p.velocity, p.velocity + Count, 0.0);
+
+        p.fitness = Evaluate(p);
+        p.bestFitness = p.fitness;
+    });
+}
+
+void GPConstantOptimisation::Update(
+    Particles& particles,
+    double* globalBestPosition,
+    PSOParameters const& params)
+{
+    auto const Count = particles.VectorSize();
+    particles.ForAll([&](auto&& p)
+    {
+        NextPosition(
+            p.position,
+            p.position + Count,
+            p.bestPosition,
+            globalBestPosition,
+            p.velocity,
+            p.position,
+            rngs_[p.id],
+            params);
+    });
+}
+
+double GPConstantOptimisation::Evaluate(
+    typename Particles::Individual const& particle)
+{
+    // The shape of the expression with the constants of the particle
+    if(tuning_.compiled != nullptr)
+        return Estemate(
+            *tuning_.data,
+            *tuning_.compiled,
+            particle.position);
+
+    auto const& Function = tuning_.function;
+    return Estemate(*tuning_.data, ExprView{
+        Function.BeginCode(),
+        Function.BeginExtents(),
+        Function.Count(),
+        particle.position,
+        Function.ConstCount()});
+}
+
+std::size_t GPConstantOptimisation::Dimension()
+{
+    return tuning_.function.ConstCount();
+}
+
+std::optional<CompiledExpr> Compile(PalletData const& data, ExprView expr)
+{
+    if(!CompiledExpr::Available || data.RowCount() < MinCompiledRows)
+        return std::nullopt;
+    return CompiledExpr{Expr{expr}};
+}
+
+double Estemate(PalletData& data, ExprView expr)
+{
+    std::vector<double> estemates(data.RowCount());
+    expr.Eval(
+        data.BeginColumnData(),
+        data.RowCount(),
+        data.RowCount(),
+        estemates.data());
+    return Estemate(data, estemates.data());
+}
+
+double Estemate(PalletData& data, CompiledExpr const& expr)
+{
+    std::vector<double> estemates(data.RowCount());
+    expr.Eval(
+        data.BeginColumnData(),
+        data.RowCount(),
+        data.RowCount(),
+        estemates.data());
+    return Estemate(data, estemates.data());
+}
+
+double Estemate(
+    PalletData& data,
+    CompiledExpr const& expr,
+    double const* consts)
+{
+    std::vector<double> estemates(data.RowCount());
+    expr.Eval(
+        data.BeginColumnData(),
+        data.RowCount(),
+        data.RowCount(),
+        estemates.data(),
+        consts);
+    return Estemate(data, estemates.data());
+}
+
+double Estemate(
+    PalletData& data,
+    SubtreeStore& store,
+    SubtreeStore::NodeId root)
+{
+    auto const Estemates = store.Eval(
+        root,
+        data.BeginColumnData(),
+        data.RowCount(),
+        data.RowCount());
+    return Estemate(data, Estemates.get());
+}
+
+double Estemate(
+    PalletData& data,
+    NodeOutputs const& parent,
+    std::size_t id,
+    ExprView replacement)
+{
+    std::vector<double> estemates(data.RowCount());
+    parent.EvalSpliced(
+        id,
+        replacement,
+        data.BeginColumnData(),
+        data.RowCount(),
+        estemates.data());
+    return Estemate(data, estemates.data());
+}
+
+double Estemate(PalletData& data, LinearProgram const& program)
+{
+    // Only the effective instructions are run
+    std::vector<double> estemates(data.RowCount());
+    EvalLinear(
+        RemoveIntrons(program),
+        data.BeginColumnData(),
+        data.RowCount(),
+        data.RowCount(),
+        estemates.data());
+    return Estemate(data, estemates.data());
+}
+
+double Estemate(PalletData& data, double const* estemates)
+{
+    auto total = 0.0;
+    if(data.Weighted())
+        total = AbsoluteError(data, estemates, 0, data.RowCount());
+    else
+        total = std::transform_reduce(
+            std::execution::par,
+            estemates,
+            estemates + data.RowCount(),
+            data.BeginDemand(),
+            0.0,
+            std::plus<double>{},
+            [](auto a, auto b) noexcept {return std::abs(a - b);});
+
+    auto const Estemation = total / data.TotalWeight();
     return std::isnan(Estemation)
         ? std::numeric_limits<double>::infinity()
         : Estemation;
 }
 
+double AbsoluteError(
+    PalletData const& data,
+    double const* estemates,
+    std::size_t first,
+    std::size_t count)
+{
+    auto const Demand = data.BeginDemand() + first;
+    auto total = 0.0;
+    if(data.Weighted())
+    {
+        // A row of a coreset stands for several rows of the data
+        auto const Weights = data.BeginWeight() + first;
+        for(std::size_t i{}; i != count; ++i)
+            total += Weights[i] * std::abs(estemates[i] - Demand[i]);
+    }
+    else
+        for(std::size_t i{}; i != count; ++i)
+            total += std::abs(estemates[i] - Demand[i]);
+    return total;
+}
+
 template<typename RngT>
-Expr GenerateRandomExpr(
+void WriteRandomExpr(
+    ExprWriter& out,
     RngT& rng,
     std::uint64_t argCount,
-    std::size_t maxDepth)
+    std::size_t maxDepth,
+    double terminalPropability)
 {
+    // A full tree has no chance of a terminal before its depth, a grown tree
+    // may end early.
+    auto const Terminal = maxDepth == 0
+        || std::uniform_real_distribution<>{ 0, 1 }(rng) < terminalPropability;
     auto const X = std::uniform_real_distribution<>{ 0, 1 }(rng);
-    if (maxDepth == 0)
+    if (Terminal)
     {
         if(X < 0.50)
-            return Const(std::uniform_real_distribution<>{ 0, 100 }(rng));
+            out.PushConst(std::uniform_real_distribution<>{ 0, 100 }(rng));
         else
-            return Arg(std::uniform_int_distribution<std::uint64_t>{0, argCount - 1}(rng));
-    }
-    else
-    {
-        auto const Lhs = GenerateRandomExpr(rng, argCount, maxDepth - 1);
-        auto const Rhs = GenerateRandomExpr(rng, argCount, maxDepth - 1);
-        if(X < 0.33)
-            return Lhs + Rhs;
-        else if (X < 0.67)
-            return Lhs - Rhs;
-        else //if (X < 0.90)
-            return Lhs * Rhs;
-        // Division seem to be a bit dangerous since division by a small
-        // number will generate VERY large numbers... so forbid division.
-        //else
-        //    return Lhs / Rhs;
+            out.PushArg(std::uniform_int_distribution<std::uint64_t>{0, argCount - 1}(rng));
+        return;
     }
+
+    if(X < 0.33)
+        out.PushOp(internal::OpCode::Add);
+    else if (X < 0.67)
+        out.PushOp(internal::OpCode::Sub);
+    else //if (X < 0.90)
+        out.PushOp(internal::OpCode::Mul);
+    // Division seem to be a bit dangerous since division by a small
+    // number will generate VERY large numbers... so forbid division.
+    //else
+    //    out.PushOp(internal::OpCode::Div);
+
+    // Prefix order, the operator is followed by its operands
+    WriteRandomExpr(out, rng, argCount, maxDepth - 1, terminalPropability);
+    WriteRandomExpr(out, rng, argCount, maxDepth - 1, terminalPropability);
+}
+
+template<typename RngT>
+void WriteRampedExpr(
+    ExprWriter& out,
+    RngT& rng,
+    std::uint64_t argCount,
+    std::size_t minDepth,
+    std::size_t maxDepth,
+    double terminalPropability)
+{
+    // Ramped half-and-half, a depth is picked at random and half of the
+    // trees are full while the other half are grown.
+    auto const Depth = std::uniform_int_distribution<std::size_t>{
+        minDepth,
+        maxDepth}(rng);
+    auto const Full = std::uniform_real_distribution<>{ 0, 1 }(rng) < 0.50;
+    WriteRandomExpr(
+        out,
+        rng,
+        argCount,
+        Depth,
+        Full ? 0.0 : terminalPropability);
 }
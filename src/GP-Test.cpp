@@ -0,0 +1,619 @@
+// Behaviour tests of the data structures of the GP. Each test draws random
+// expressions and data and checks a structure against the plain interpreter
+// or a direct computation, printing the first case which fails. The run
+// fails if any test does. The optional argument is the seed.
+#define CS3910_NO_MAIN
+#include "GP-Main.cpp"
+#include "CS3910/Bench.h"
+#include "CS3910/Fidelity.h"
+#include "CS3910/ParetoArchive.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+// Configuration
+// A few blocks and a part of one, so that the blocked kernels see every
+// case.
+constexpr std::size_t Rows = 3 * internal::EvalBlockSize + 17;
+constexpr std::size_t Columns = 5;
+constexpr std::size_t MaxDepth = 6;
+constexpr std::size_t MaxSize = 127;
+
+// A random expression as the GP grows them.
+Expr RandomTestExpr(std::minstd_rand& rng);
+
+// Whether two results agree bit for bit, any NaN agrees with any other.
+bool SameResult(double a, double b) noexcept;
+
+// Whether every row of the output matches the expected one, printing the
+// first which does not.
+bool SameRows(
+    double const* output,
+    std::vector<double> const& expected,
+    ExprView expr,
+    char const* what);
+
+// SubtreeStore::Eval matches Expr::Eval over generations of crossover
+// children, which share many subtrees, whether their shared outputs fit in
+// the memory budget or keep being evicted.
+bool TestSubtreeStore(std::minstd_rand& rng);
+
+// NodeOutputs::EvalSpliced matches evaluating the spliced expression in full,
+// over all rows and over a window of them, and the output of every node
+// matches evaluating its subtree.
+bool TestNodeOutputs(std::minstd_rand& rng);
+
+// Simplifying keeps the value of random expressions, wrapped in the
+// identities the simplifier removes, for random finite arguments, up to the
+// rounding of the constants it gathers. The simplified expressions are never
+// larger, and appending them to an arena gives the same expression with the
+// same extents as Expr::Simplify. A subtree which overflows for finite
+// arguments is not taken to cancel itself.
+bool TestSimplifier(std::minstd_rand& rng);
+
+// AliasTable samples every index about as often as its share of the weights,
+// and every index as often when the weights have no positive total. A
+// Tournament of everyone not skipped picks the best of them.
+bool TestSelection(std::minstd_rand& rng);
+
+// ExprView::Range encloses the value of random expressions, divisions
+// included, for arguments sampled within the ranges of the arguments, their
+// ends included. A value is only NaN where the range is unbounded, and only
+// infinite where the range is.
+bool TestRange(std::minstd_rand& rng);
+
+// ParetoArchive keeps exactly the expressions offered which no other beats on
+// both fitness and size, the first offered of any equals, ordered by size.
+// Insert says whether it kept an expression as Accepts did before.
+bool TestParetoArchive(std::minstd_rand& rng);
+
+// The rows of a Coreset weigh as many rows as the data has, every row at
+// least itself, and there are no more of them than asked for. Data whose
+// rows are all the same has a coreset of one row.
+bool TestCoreset(std::minstd_rand& rng);
+
+int main(int argc, char const** argv)
+{
+    struct Test
+    {
+        char const* name;
+        bool (*run)(std::minstd_rand& rng);
+    };
+    constexpr Test Tests[] = {
+        {"SubtreeStore::Eval", TestSubtreeStore},
+        {"NodeOutputs::EvalSpliced", TestNodeOutputs},
+        {"Expr::Simplify", TestSimplifier},
+        {"AliasTable::Sample", TestSelection},
+        {"ExprView::Range", TestRange},
+        {"ParetoArchive::Insert", TestParetoArchive},
+        {"Coreset", TestCoreset}};
+
+    auto const Seed = 1 < argc ? std::stoul(argv[1]) : 1ul;
+    auto failed = false;
+    for(auto const& test: Tests)
+    {
+        std::minstd_rand rng{static_cast<std::minstd_rand::result_type>(
+            Seed)};
+        auto const Passed = test.run(rng);
+        std::cout << (Passed ? "Passed " : "FAILED ") << test.name << '\n';
+        failed = failed || !Passed;
+    }
+
+    return failed ? 1 : 0;
+}
+
+Expr RandomTestExpr(std::minstd_rand& rng)
+{
+    ExprArena arena{};
+    return Expr{arena.View(arena.Write([&](ExprWriter& out)
+    {
+        WriteRandomExpr(out, rng, Columns, MaxDepth, 0.3);
+    }))};
+}
+
+bool SameResult(double a, double b) noexcept
+{
+    if(std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b);
+
+    std::uint64_t bitsA, bitsB;
+    std::memcpy(&bitsA, &a, sizeof(a));
+    std::memcpy(&bitsB, &b, sizeof(b));
+    return bitsA == bitsB;
+}
+
+bool SameRows(
+    double const* output,
+    std::vector<double> const& expected,
+    ExprView expr,
+    char const* what)
+{
+    for(std::size_t i{}; i != expected.size(); ++i)
+        if(!SameResult(output[i], expected[i]))
+        {
+            std::cout << std::setprecision(17) << what << ": row " << i
+                << " of " << expr << " is " << output[i] << ", expected "
+                << expected[i] << '\n';
+            return false;
+        }
+    return true;
+}
+
+bool TestSubtreeStore(std::minstd_rand& rng)
+{
+    constexpr std::size_t Generations = 5;
+    constexpr std::size_t Population = 40;
+
+    auto const Data = RandomPalletData(Rows, Columns, 1);
+    std::vector<double> expected(Rows);
+    for(auto const Budget: {std::size_t{1} << 24, std::size_t{1} << 12})
+    {
+        SubtreeStore store{Budget};
+        std::vector<Expr> population{};
+        for(std::size_t i{}; i != Population; ++i)
+            population.push_back(RandomTestExpr(rng));
+
+        for(std::size_t g{}; g != Generations; ++g)
+        {
+            std::vector<Expr> offspring{};
+            for(std::size_t i{}; i != Population; i += 2)
+            {
+                auto [a, b] = SubtreeCrossover(
+                    population[i],
+                    population[(i + 3) % Population],
+                    MaxSize,
+                    rng);
+                offspring.push_back(std::move(a));
+                offspring.push_back(std::move(b));
+            }
+
+            // The parents are evaluated again alongside their children
+            offspring.insert(
+                offspring.end(),
+                population.begin(),
+                population.end());
+            store.NewGeneration();
+            std::vector<SubtreeStore::NodeId> roots{};
+            for(auto const& function: offspring)
+                roots.push_back(store.Insert(function));
+            store.Prune();
+
+            for(std::size_t i{}; i != offspring.size(); ++i)
+            {
+                auto const Output = store.Eval(
+                    roots[i],
+                    Data.BeginColumnData(),
+                    Data.RowCount(),
+                    Data.RowCount());
+                offspring[i].Eval(
+                    Data.BeginColumnData(),
+                    Data.RowCount(),
+                    Data.RowCount(),
+                    expected.data());
+                if(!SameRows(Output.get(), expected, offspring[i], "Store"))
+                    return false;
+            }
+
+            offspring.erase(
+                offspring.begin() + Population,
+                offspring.end());
+            population.swap(offspring);
+        }
+    }
+
+    return true;
+}
+
+bool TestNodeOutputs(std::minstd_rand& rng)
+{
+    constexpr std::size_t Functions = 50;
+    constexpr std::size_t Splices = 10;
+
+    auto const Data = RandomPalletData(Rows, Columns, 2);
+    auto const* ColumnData = Data.BeginColumnData();
+    std::vector<double> expected(Rows);
+    std::vector<double> out(Rows);
+    for(std::size_t k{}; k != Functions; ++k)
+    {
+        auto const Function = RandomTestExpr(rng);
+        NodeOutputs const Outputs{Function, ColumnData, Rows, Rows};
+        for(std::size_t id{}; id != Function.Count(); ++id)
+        {
+            auto const Sub = Function.SubExpr(id);
+            Sub.Eval(ColumnData, Rows, Rows, expected.data());
+            if(!SameRows(Outputs.Output(id), expected, Sub, "Output"))
+                return false;
+        }
+
+        for(std::size_t s{}; s != Splices; ++s)
+        {
+            auto const Id = std::uniform_int_distribution<std::size_t>{
+                0,
+                Function.Count() - 1}(rng);
+            auto const Replacement = RandomTestExpr(rng);
+            auto spliced = Function;
+            if(!spliced.Replace(Id, Replacement))
+                spliced = Replacement;
+
+            spliced.Eval(ColumnData, Rows, Rows, expected.data());
+            Outputs.EvalSpliced(
+                Id,
+                Replacement,
+                ColumnData,
+                Rows,
+                out.data());
+            if(!SameRows(out.data(), expected, spliced, "Spliced"))
+                return false;
+
+            // A window of the rows lands at the start of the output
+            auto const First = std::uniform_int_distribution<std::size_t>{
+                0,
+                Rows - 1}(rng);
+            auto const Count = std::uniform_int_distribution<std::size_t>{
+                1,
+                Rows - First}(rng);
+            Outputs.EvalSpliced(
+                Id,
+                Replacement,
+                ColumnData,
+                Rows,
+                First,
+                Count,
+                out.data());
+            expected.erase(expected.begin(), expected.begin() + First);
+            expected.resize(Count);
+            if(!SameRows(out.data(), expected, spliced, "Window"))
+                return false;
+            expected.resize(Rows);
+        }
+    }
+
+    return true;
+}
+
+bool TestSimplifier(std::minstd_rand& rng)
+{
+    constexpr std::size_t Functions = 500;
+    constexpr std::size_t Samples = 20;
+    constexpr double Tolerance = 1e-9;
+
+    std::vector<double> args(Columns);
+    ExprArena arena{};
+    for(std::size_t k{}; k != Functions; ++k)
+    {
+        auto const E = RandomTestExpr(rng);
+        auto const F = RandomTestExpr(rng);
+        Expr const Cases[] = {
+            E,
+            E - E,
+            E * Const(0.0) + F,
+            Const(1.0) * E - F * Const(1.0),
+            (E + Const(0.0)) / Const(1.0),
+            Const(2.0) * (Const(3.0) * E),
+            (E + Const(2.0)) + (Const(3.0) + F),
+            E * (F - F) + E / Const(1.0)};
+        for(auto const& function: Cases)
+        {
+            auto const Simplified = function.Simplify();
+            if(function.Count() < Simplified.Count())
+            {
+                std::cout << "Simplify grew " << function << " into "
+                    << Simplified << '\n';
+                return false;
+            }
+
+            arena.Clear();
+            auto const Appended = arena.View(
+                arena.AppendSimplified(function));
+            std::vector<internal::Extent> extents(Appended.Count());
+            internal::IndexExpr(
+                Appended.BeginCode(),
+                Appended.EndCode(),
+                extents.begin());
+            auto const SameExtents = std::equal(
+                extents.cbegin(),
+                extents.cend(),
+                Appended.BeginExtents(),
+                [](auto const& a, auto const& b) noexcept
+                {
+                    return a.size == b.size
+                        && a.consts == b.consts
+                        && a.depth == b.depth
+                        && a.constOffset == b.constOffset;
+                });
+            if(Appended != Simplified || !SameExtents)
+            {
+                std::cout << "AppendSimplified gave " << Appended
+                    << " for " << Simplified << '\n';
+                return false;
+            }
+
+            for(std::size_t i{}; i != Samples; ++i)
+            {
+                for(auto& x: args)
+                    x = std::uniform_real_distribution<>{-1e3, 1e3}(rng);
+                auto const Expected = function.Eval(args.cbegin());
+                auto const Value = Simplified.Eval(args.cbegin());
+                auto const Scale = std::max(
+                    std::abs(Expected),
+                    std::abs(Value));
+                if(!(SameResult(Value, Expected)
+                    || std::abs(Value - Expected) <= Tolerance * Scale))
+                {
+                    std::cout << std::setprecision(17) << function
+                        << " is " << Expected << " but simplified to "
+                        << Simplified << " is " << Value << '\n';
+                    return false;
+                }
+            }
+        }
+    }
+
+    // x * x overflows for large finite x, and inf - inf is not 0
+    auto const Square = Arg(0) * Arg(0);
+    auto const Cancelled = (Square - Square).Simplify();
+    args.assign(Columns, 1e200);
+    if(!std::isnan(Cancelled.Eval(args.cbegin())))
+    {
+        std::cout << "Simplify cancelled " << Square - Square << " into "
+            << Cancelled << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+bool TestSelection(std::minstd_rand& rng)
+{
+    constexpr std::size_t Weights = 50;
+    constexpr std::size_t Draws = 500000;
+
+    // Some of the weights are zero and are never to be drawn
+    std::vector<double> weights(Weights);
+    for(auto& w: weights)
+        w = std::uniform_int_distribution<>{0, 3}(rng) == 0
+            ? 0.0
+            : std::uniform_real_distribution<>{0, 10}(rng);
+    auto const Total = std::accumulate(weights.cbegin(), weights.cend(), 0.0);
+    std::vector<double> zeros(Weights, 0.0);
+
+    AliasTable table{};
+    std::vector<std::size_t> counts(Weights);
+    for(auto const* cases: {&weights, &zeros})
+    {
+        table.Build(cases->cbegin(), cases->cend(), [](auto w) { return w; });
+        std::fill(counts.begin(), counts.end(), std::size_t{});
+        for(std::size_t i{}; i != Draws; ++i)
+            ++counts[table.Sample(rng)];
+
+        // Within five standard deviations of the expected count
+        for(std::size_t i{}; i != Weights; ++i)
+        {
+            auto const P = cases == &zeros
+                ? 1.0 / Weights
+                : weights[i] / Total;
+            auto const Expected = P * Draws;
+            auto const Deviation = std::sqrt(Draws * P * (1 - P));
+            auto const Count = static_cast<double>(counts[i]);
+            if(5 * Deviation < std::abs(Count - Expected)
+                || (P == 0.0 && counts[i] != 0))
+            {
+                std::cout << "AliasTable drew index " << i << ' ' << Count
+                    << " times, expected " << Expected << '\n';
+                return false;
+            }
+        }
+    }
+
+    auto const Skipped = weights.cbegin() + 7;
+    auto const Best = Tournament(
+        weights.cbegin(),
+        weights.cend(),
+        Weights - 1,
+        rng,
+        std::greater<>{},
+        {Skipped});
+    auto expected = weights;
+    expected[Skipped - weights.cbegin()] = -1.0;
+    if(*Best != *std::max_element(expected.cbegin(), expected.cend()))
+    {
+        std::cout << "Tournament of all picked " << *Best << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+bool TestRange(std::minstd_rand& rng)
+{
+    constexpr std::size_t Functions = 500;
+    constexpr std::size_t Samples = 50;
+
+    std::vector<Interval> ranges(Columns);
+    std::vector<double> args(Columns);
+    for(std::size_t k{}; k != Functions; ++k)
+    {
+        for(auto& range: ranges)
+        {
+            auto const A = std::uniform_real_distribution<>{-100, 100}(rng);
+            auto const B = std::uniform_real_distribution<>{-100, 100}(rng);
+            range = {std::min(A, B), std::max(A, B)};
+        }
+
+        auto const E = RandomTestExpr(rng);
+        auto const F = RandomTestExpr(rng);
+        Expr const Cases[] = {
+            E,
+            E / F,
+            E / (F * F + Const(1.0)),
+            (E - F) / Const(3.0),
+            Arg(0) / (Arg(0) - Arg(0))};
+        for(auto const& function: Cases)
+        {
+            auto const Range = ExprView{function}.Range(ranges.data());
+            auto const Bounded = std::isfinite(Range.lo)
+                && std::isfinite(Range.hi);
+            for(std::size_t i{}; i != Samples; ++i)
+            {
+                // The first samples are at the ends of the ranges
+                for(std::size_t j{}; j != Columns; ++j)
+                    args[j] = i < 2
+                        ? (i == 0 ? ranges[j].lo : ranges[j].hi)
+                        : std::uniform_real_distribution<>{
+                            ranges[j].lo,
+                            ranges[j].hi}(rng);
+
+                auto const Value = function.Eval(args.cbegin());
+                if(std::isnan(Value)
+                    ? Bounded
+                    : Value < Range.lo || Range.hi < Value)
+                {
+                    std::cout << std::setprecision(17) << function << " is "
+                        << Value << " outside of [" << Range.lo << ", "
+                        << Range.hi << "]\n";
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool TestParetoArchive(std::minstd_rand& rng)
+{
+    constexpr std::size_t Archives = 20;
+    constexpr std::size_t Offers = 200;
+    constexpr auto Inf = std::numeric_limits<double>::infinity();
+
+    struct Offer
+    {
+        Expr function;
+        double fitness;
+    };
+
+    for(std::size_t k{}; k != Archives; ++k)
+    {
+        // Few sizes and fitnesses, so that there are many ties
+        ParetoArchive archive{};
+        std::vector<Offer> offers{};
+        for(std::size_t i{}; i != Offers; ++i)
+        {
+            ExprArena arena{};
+            auto function = Expr{arena.View(arena.Write([&](ExprWriter& out)
+            {
+                WriteRandomExpr(out, rng, Columns, 4, 0.3);
+            }))};
+            auto const Fitness = std::uniform_int_distribution<>{0, 30}(rng);
+            offers.push_back({
+                std::move(function),
+                Fitness == 0 ? Inf : static_cast<double>(Fitness)});
+
+            auto const& Offered = offers.back();
+            auto const Accepted = archive.Accepts(
+                Offered.fitness,
+                Offered.function.Count());
+            if(archive.Insert(Offered.function, Offered.fitness) != Accepted)
+            {
+                std::cout << "Insert and Accepts disagree on "
+                    << Offered.function << '\n';
+                return false;
+            }
+        }
+
+        // An offer is kept unless another is at least as good on both and
+        // better on one, or is the same and was offered first
+        std::vector<Offer const*> expected{};
+        for(auto const& offer: offers)
+        {
+            auto const Size = offer.function.Count();
+            auto const Beaten = std::any_of(
+                offers.data(),
+                offers.data() + offers.size(),
+                [&](auto const& other)
+                {
+                    auto const OtherSize = other.function.Count();
+                    if(Size < OtherSize || offer.fitness < other.fitness)
+                        return false;
+                    return OtherSize < Size
+                        || other.fitness < offer.fitness
+                        || &other < &offer;
+                });
+            if(offer.fitness < Inf && !Beaten)
+                expected.push_back(&offer);
+        }
+        std::sort(expected.begin(), expected.end(), [](auto a, auto b)
+        {
+            return a->function.Count() < b->function.Count();
+        });
+
+        auto const& Front = archive.Front();
+        auto const Same = std::equal(
+            Front.cbegin(),
+            Front.cend(),
+            expected.cbegin(),
+            expected.cend(),
+            [](auto const& entry, auto const* offer)
+            {
+                return entry.fitness == offer->fitness
+                    && entry.function == offer->function;
+            });
+        if(!Same)
+        {
+            std::cout << "The front is\n";
+            for(auto const& entry: Front)
+                std::cout << entry.fitness << " [" << entry.function
+                    << "]\n";
+            std::cout << "but expected\n";
+            for(auto const* offer: expected)
+                std::cout << offer->fitness << " [" << offer->function
+                    << "]\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TestCoreset(std::minstd_rand& rng)
+{
+    auto const Data = RandomPalletData(Rows, Columns, 3);
+    auto const Same = PalletData{Data, std::vector<std::size_t>(Rows, 0)};
+    for(auto const* data: {&Data, &Same})
+        for(auto const Size: {std::size_t{1}, std::size_t{10}, Rows, 2 * Rows})
+        {
+            auto const Core = Coreset(*data, Size, rng);
+            auto const* Weights = Core.BeginWeight();
+            auto const Total = std::accumulate(
+                Weights,
+                Weights + Core.RowCount(),
+                0.0);
+            auto const Expected = data == &Same
+                ? std::size_t{1}
+                : std::min(Size, Rows);
+            if(Total != static_cast<double>(data->RowCount())
+                || Core.TotalWeight() != Total
+                || Core.RowCount() != Expected
+                || std::any_of(
+                    Weights,
+                    Weights + Core.RowCount(),
+                    [](auto w) noexcept { return w < 1.0; }))
+            {
+                std::cout << "A coreset of " << Size << " has "
+                    << Core.RowCount() << " rows weighing " << Total
+                    << ", expected " << Expected << " weighing "
+                    << data->RowCount() << '\n';
+                return false;
+            }
+        }
+
+    return true;
+}
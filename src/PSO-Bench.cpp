@@ -0,0 +1,147 @@
+// Microbenchmarks of the hot kernels of the PSO, see Bench.h. The optional
+// argument picks the benchmarks whose name contains it, the results are
+// written as a line of JSON per run.
+#define CS3910_NO_MAIN
+#include "PSO-Main.cpp"
+#include "CS3910/Bench.h"
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+// The positions, velocities and bests of a swarm, a particle after another.
+struct Swarm
+{
+    Swarm(std::size_t particles, std::size_t dimension);
+
+    std::vector<double> positions;
+    std::vector<double> velocities;
+    std::vector<double> bestPositions;
+    std::vector<double> globalBest;
+    std::size_t dimension;
+    std::minstd_rand rng{1};
+};
+
+// The usual constriction parameters
+constexpr PSOParameters BenchParameters{0.72, 1.19, 1.19};
+
+int main(int argc, char const** argv)
+{
+    // The columns of the sample data
+    constexpr std::size_t Columns = 13;
+
+    BenchSuite suite{};
+    suite.Add(
+        "Estemate/Linear",
+        ParamGrid({
+            {"rows", {1000, 10000, 100000}},
+            {"columns", {4, Columns, 32}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Data = std::make_shared<PalletData>(RandomPalletData(
+                Param(params, "rows"),
+                Param(params, "columns"),
+                1));
+            auto const Weights = std::make_shared<std::vector<double>>(
+                Data->DataCount(),
+                0.5);
+            return [Data, Weights]
+            {
+                KeepValue(Estemate(*Data, Weights->cbegin()));
+            };
+        });
+
+    suite.Add(
+        "NextVelocity",
+        ParamGrid({
+            {"particles", {20, 100, 1000}},
+            {"dimension", {4, Columns, 128}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const S = std::make_shared<Swarm>(
+                Param(params, "particles"),
+                Param(params, "dimension"));
+            return [S]
+            {
+                auto const Count = S->positions.size();
+                for(std::size_t i{}; i != Count; i += S->dimension)
+                    NextVelocity(
+                        S->positions.cbegin() + i,
+                        S->positions.cbegin() + i + S->dimension,
+                        S->bestPositions.cbegin() + i,
+                        S->globalBest.cbegin(),
+                        S->velocities.cbegin() + i,
+                        S->velocities.begin() + i,
+                        S->rng,
+                        BenchParameters);
+                KeepValue(S->velocities.front());
+            };
+        });
+
+    suite.Add(
+        "NextPosition",
+        ParamGrid({
+            {"particles", {20, 100, 1000}},
+            {"dimension", {4, Columns, 128}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const S = std::make_shared<Swarm>(
+                Param(params, "particles"),
+                Param(params, "dimension"));
+            return [S]
+            {
+                auto const Count = S->positions.size();
+                for(std::size_t i{}; i != Count; i += S->dimension)
+                    NextPosition(
+                        S->positions.cbegin() + i,
+                        S->positions.cbegin() + i + S->dimension,
+                        S->bestPositions.cbegin() + i,
+                        S->globalBest.cbegin(),
+                        S->velocities.begin() + i,
+                        S->positions.begin() + i,
+                        S->rng,
+                        BenchParameters);
+                KeepValue(S->positions.front());
+            };
+        });
+
+    // A step of a run from its start, the run starts over at its end
+    suite.Add(
+        "BasicPSO::Step",
+        ParamGrid({
+            {"rows", {1000, 10000}},
+            {"columns", {Columns}},
+            {"particles", {20, 100}}}),
+        [](auto const& params) -> BenchSuite::Body
+        {
+            auto const Data = RandomPalletData(
+                Param(params, "rows"),
+                Param(params, "columns"),
+                1);
+            auto const Pso = std::make_shared<PSOPalletDemandMinimisation>(
+                PalletProblem{Data, SolveLeastAbsoluteDeviation(Data)},
+                Param(params, "particles"));
+            Pso->Initialise();
+            return [Pso]
+            {
+                Pso->Step();
+                if(Pso->Terminate())
+                    Pso->Initialise();
+            };
+        });
+
+    suite.Run(1 < argc ? argv[1] : "", std::cout);
+}
+
+Swarm::Swarm(std::size_t particles, std::size_t dimension)
+    : positions(particles * dimension)
+    , velocities(particles * dimension)
+    , bestPositions(particles * dimension)
+    , globalBest(dimension)
+    , dimension{dimension}
+{
+    std::uniform_real_distribution<> x{-1.0, 1.0};
+    for(auto* values: {&positions, &velocities, &bestPositions, &globalBest})
+        for(auto& value: *values)
+            value = x(rng);
+}
@@ -1,10 +1,13 @@
+#include "CS3910/CMAES.h"
 #include "CS3910/Core.h"
 #include "CS3910/Pallets.h"
 #include "CS3910/PSO.h"
+#include "CS3910/Regression.h"
 #include "CS3910/Simulation.h"
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstring>
 #include <execution>
 #include <fstream>
 #include <numeric>
@@ -16,13 +19,27 @@
 template<typename ForwardIt>
 double Estemate(PalletData& data, ForwardIt weightIt);
 
+// The data to fit along with the solution the swarm is warm started from,
+// which is solved once for the data and shared by every swarm. An empty warm
+// start seeds the whole swarm at random.
+struct PalletProblem
+{
+    PalletData data;
+    std::vector<double> warmStart;
+};
+
 class PSOPalletDemandOptimisation
 {
 public:
     constexpr static auto StartingFitness
         = std::numeric_limits<double>::infinity();
 
-    explicit PSOPalletDemandOptimisation(PalletData const& historicalData);
+    // Refine the RefinementCount best particles every RefinementInterval
+    // iterations with a few steps of subgradient descent.
+    constexpr static std::size_t RefinementInterval = 10;
+    constexpr static std::size_t RefinementCount = 3;
+
+    explicit PSOPalletDemandOptimisation(PalletProblem const& problem);
 
     void Init(Particles& particles);
 
@@ -32,6 +49,8 @@ public:
         PSOParameters const& params);
 
     double Evaluate(typename Particles::Individual const& particle);
+
+    void Refine(typename Particles::Individual& particle);
     
     std::size_t Dimension();
 
@@ -40,13 +59,32 @@ public:
         return a < b;
     }
 private:
+    // Configuration
+    // The fraction of the swarm seeded around the warm start, the rest is
+    // seeded at random. Set to 0 to disable the warm start.
+    constexpr static double WarmStartFraction = 0.5;
+    constexpr static double WarmStartSpread = 0.1;
+    constexpr static std::size_t RefinementSteps = 5;
+
     PalletData historicalData_;
 
     std::vector<std::minstd_rand> rngs_;
+
+    // The residuals of the last evaluated and the best position of each
+    // particle, kept so that the refinement does not recompute them.
+    std::vector<double> residuals_;
+
+    std::vector<double> bestResiduals_;
+
+    std::vector<double> warmStart_;
 };
 
 using PSOPalletDemandMinimisation = BasicPSO<
-    PalletData,
+    PalletProblem,
+    PSOPalletDemandOptimisation>;
+
+using CMAESPalletDemandMinimisation = BasicCMAES<
+    PalletProblem,
     PSOPalletDemandOptimisation>;
 
 
@@ -83,16 +121,46 @@ private:
     std::minstd_rand rng_;
 };
 
+// The swarms of the meta search start cold, a warm started swarm scores about
+// the same for any parameters and the search would select on noise.
 using MetaPSOPalletDemandMinimisation = BasicPSO<
-    PalletData,
-    PSOMetaOptimisation<PalletData, PSOPalletDemandMinimisation>>;
+    PalletProblem,
+    PSOMetaOptimisation<PalletProblem, PSOPalletDemandMinimisation>>;
 
+// The benchmarks include this file without its entry point
+#ifndef CS3910_NO_MAIN
 int main(int argc, char const** argv) try
 {
     auto dataSet = ReadPalletData(argc, argv, std::cout);
 
+    // The solver only baseline which the swarm is warm started from
+    auto const Baseline = SolveLeastAbsoluteDeviation(dataSet.trainingData);
+    std::cout << "LAD " << Estemate(dataSet.testingData, Baseline.begin())
+        << '|';
+    for(auto&& x: Baseline)
+        std::cout << ' ' << x;
+    std::cout << '\n';
+
+    // An optional third argument picks the CMA-ES engine instead
+    if(3 < argc && std::string{argv[3]} == "cmaes")
+    {
+        CMAESPalletDemandMinimisation cmaes{
+            PalletProblem{dataSet.trainingData, Baseline}};
+        auto result = Simulate(cmaes);
+
+        std::cout << Estemate(dataSet.testingData, result.position.begin())
+            << '|';
+        for(auto&& x: result.position)
+            std::cout << ' ' << x;
+        std::cout << '\n';
+        return 0;
+    }
+
     // Explore some parameter sets
-    MetaPSOPalletDemandMinimisation hyperPSO{dataSet.trainingData, 21, 100};
+    MetaPSOPalletDemandMinimisation hyperPSO{
+        PalletProblem{dataSet.trainingData, {}},
+        21,
+        100};
     auto hyperResult = Simulate(hyperPSO);
     
     PSOParameters params;
@@ -102,7 +170,7 @@ int main(int argc, char const** argv) try
     auto const Particles = static_cast<std::size_t>(
         20 + std::sqrt(dataSet.trainingData.DataCount()));
     PSOPalletDemandMinimisation pso{
-        dataSet.trainingData,
+        PalletProblem{dataSet.trainingData, Baseline},
         Particles,
         100000,
         params};
@@ -125,10 +193,12 @@ catch (std::exception& e)
 {
     std::cout << e.what();
 }
+#endif // !CS3910_NO_MAIN
 
 PSOPalletDemandOptimisation::PSOPalletDemandOptimisation(
-    PalletData const& historicalData)
-    : historicalData_{ historicalData }
+    PalletProblem const& problem)
+    : historicalData_{ problem.data }
+    , warmStart_{ problem.warmStart }
 {
 }
 
@@ -143,19 +213,46 @@ void PSOPalletDemandOptimisation::Init(Particles& particles)
         rng.seed(rand());
     });
 
+    residuals_.assign(
+        particles.PopulationSize() * historicalData_.RowCount(),
+        0.0);
+    bestResiduals_ = residuals_;
+
+    auto const WarmCount = warmStart_.empty()
+        ? std::size_t{}
+        : static_cast<std::size_t>(
+            WarmStartFraction * particles.PopulationSize());
+
     particles.ForAll([&](auto&& p)
     {
-        std::generate(
-            p.position,
-            p.position + Count,
-            [&]()
-            {
-                using Distribution = std::uniform_real_distribution<>;
-                return Distribution{0, 1}(rngs_[p.id]);
-            });
+        // Keep the first particle on the solution and scatter the rest of
+        // the warm started particles around it.
+        if(p.id == 0 && WarmCount != 0)
+            std::copy(warmStart_.cbegin(), warmStart_.cend(), p.position);
+        else if(p.id < WarmCount)
+            std::transform(
+                warmStart_.cbegin(),
+                warmStart_.cend(),
+                p.position,
+                [&](auto x)
+                {
+                    using Distribution = std::normal_distribution<>;
+                    return x + Distribution{0, WarmStartSpread}(rngs_[p.id])
+                        * (std::abs(x) + 1);
+                });
+        else
+            std::generate(
+                p.position,
+                p.position + Count,
+                [&]()
+                {
+                    using Distribution = std::uniform_real_distribution<>;
+                    return Distribution{0, 1}(rngs_[p.id]);
+                });
         std::copy(p.position, p.position + Count, p.bestPosition);
         std::fill(p.velocity, p.velocity + Count, 0.0);
 
+        p.bestFitness = StartingFitness;
         p.fitness = Evaluate(p);
         p.bestFitness = p.fitness;
     });
@@ -184,7 +281,33 @@ void PSOPalletDemandOptimisation::Update(
 double PSOPalletDemandOptimisation::Evaluate(
     typename Particles::Individual const& particle)
 {
-    return Estemate(historicalData_, particle.position);
+    auto const Rows = historicalData_.RowCount();
+    auto const First = residuals_.begin() + particle.id * Rows;
+    internal::Residuals(historicalData_, particle.position, First);
+    auto const Fitness = std::accumulate(
+        First,
+        First + Rows,
+        0.0,
+        [](auto acc, auto r) { return acc + std::abs(r); }) / Rows;
+
+    // The particle is about to take this position as its personal best
+    if(Compare(Fitness, particle.bestFitness))
+        std::copy(
+            First,
+            First + Rows,
+            bestResiduals_.begin() + particle.id * Rows);
+    return Fitness;
+}
+
+void PSOPalletDemandOptimisation::Refine(
+    typename Particles::Individual& particle)
+{
+    auto const Rows = historicalData_.RowCount();
+    particle.bestFitness = DescendLeastAbsoluteDeviation(
+        historicalData_,
+        particle.bestPosition,
+        bestResiduals_.data() + particle.id * Rows,
+        RefinementSteps);
 }
 
 std::size_t PSOPalletDemandOptimisation::Dimension()